@@ -15,22 +15,25 @@ public:
 	{
 	}
 
-	AABB(const Triangle& triangle)
+	AABB(const Triangle& triangle, const VertexBuffer& vertices)
 	{
-		minPoint = min(minPoint, min(triangle.v0.position, min(triangle.v1.position, triangle.v2.position)));
-		maxPoint = max(maxPoint, max(triangle.v0.position, max(triangle.v1.position, triangle.v2.position)));
+		const Vector3& v0 = triangle.getPosition(vertices, 0);
+		const Vector3& v1 = triangle.getPosition(vertices, 1);
+		const Vector3& v2 = triangle.getPosition(vertices, 2);
+		minPoint = min(minPoint, min(v0, min(v1, v2)));
+		maxPoint = max(maxPoint, max(v0, max(v1, v2)));
 	}
 
-	AABB(const std::vector<Triangle>& triangles, Range range)
+	AABB(const std::vector<Triangle>& triangles, const VertexBuffer& vertices, Range range)
 	{
 		AABB resAABB;
 
 		auto start = triangles.begin() + range.start;
 		auto end = triangles.begin() + range.end;
 
-		std::for_each(start, end, [&resAABB](const auto& triangle)
+		std::for_each(start, end, [&resAABB, &vertices](const auto& triangle)
 		{
-			AABB triAABB(triangle);
+			AABB triAABB(triangle, vertices);
 			resAABB |= triAABB;
 		});
 
@@ -108,4 +111,28 @@ public:
 
 		return minT < maxT;
 	}
+
+	// Same test, entryDistance receives the distance at which the ray enters the box, 0 from inside
+	bool intersect(const Ray& ray, float& entryDistance) const
+	{
+		float minT = 0.f;
+		float maxT = ray.maxT;
+
+		for (uint8_t d = 0; d < 3; ++d)
+		{
+			float t1 = (minPoint[d] - ray.origin[d]) * ray.directionNInv[d];
+			float t2 = (maxPoint[d] - ray.origin[d]) * ray.directionNInv[d];
+
+			if (t1 > t2)
+				std::swap(t1, t2);
+
+			t2 *= 1.f + std::numeric_limits<float>::epsilon();
+
+			minT = std::max(minT, t1);
+			maxT = std::min(maxT, t2);
+		}
+
+		entryDistance = minT;
+		return minT < maxT;
+	}
 };
@@ -0,0 +1,1649 @@
+#include "BVH.hpp"
+
+#include <memory>
+#include <numeric>
+#include <queue>
+
+#include "ThreadPool.hpp"
+
+namespace
+{
+	uint32_t getBinIndex(float centroid, float centroidMin, float binScale, uint32_t binCount)
+	{
+		const auto bin = static_cast<uint32_t>((centroid - centroidMin) * binScale);
+		return std::min(bin, binCount - 1);
+	}
+
+	uint32_t getChunkCount(Range range, const ThreadPool* threadPool, uint32_t minChunkSize)
+	{
+		if (!threadPool)
+			return 1;
+
+		const auto maxChunkCount = static_cast<uint32_t>(threadPool->GetThreadCount() * 4);
+		return std::clamp(range.count() / minChunkSize, 1u, maxChunkCount);
+	}
+
+	Range getChunk(Range range, uint32_t chunkCount, uint32_t chunkIndex)
+	{
+		const uint64_t count = range.count();
+		return {
+			range.start + static_cast<uint32_t>(count * chunkIndex / chunkCount),
+			range.start + static_cast<uint32_t>(count * (chunkIndex + 1) / chunkCount)
+		};
+	}
+
+	// Calls func(chunkIndex, chunkRange) for every chunk of the range and waits for all of them
+	template <typename Func>
+	void forEachChunk(Range range, uint32_t chunkCount, ThreadPool* threadPool, Func&& func)
+	{
+		if (chunkCount == 1)
+		{
+			func(0u, range);
+			return;
+		}
+
+		threadPool->ParallelFor(0, chunkCount, 1, [&](uint32_t firstChunk, uint32_t lastChunk)
+		{
+			for (uint32_t chunkIndex = firstChunk; chunkIndex < lastChunk; ++chunkIndex)
+				func(chunkIndex, getChunk(range, chunkCount, chunkIndex));
+		});
+	}
+
+	// Spread the low 10/21 bits of value so that two zero bits separate each of them
+	uint32_t spreadBits(uint32_t value)
+	{
+		value &= 0x3ff;
+		value = (value | value << 16) & 0x030000ff;
+		value = (value | value << 8) & 0x0300f00f;
+		value = (value | value << 4) & 0x030c30c3;
+		value = (value | value << 2) & 0x09249249;
+		return value;
+	}
+
+	uint64_t spreadBits(uint64_t value)
+	{
+		value &= 0x1fffff;
+		value = (value | value << 32) & 0x001f00000000ffffull;
+		value = (value | value << 16) & 0x001f0000ff0000ffull;
+		value = (value | value << 8) & 0x100f00f00f00f00full;
+		value = (value | value << 4) & 0x10c30c30c30c30c3ull;
+		value = (value | value << 2) & 0x1249249249249249ull;
+		return value;
+	}
+
+	// 30-bit code for uint32_t, 63-bit code for uint64_t. The position is relative to the centroid bounds,
+	// x ends up in the highest bit of every triple
+	template <typename MortonCode>
+	MortonCode encodeMorton(const Vector3& relativePosition)
+	{
+		constexpr uint32_t bitsPerAxis = sizeof(MortonCode) == 4 ? 10 : 21;
+		constexpr auto cellCount = static_cast<float>(1u << bitsPerAxis);
+
+		MortonCode code = 0;
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			const float cell = std::clamp(relativePosition[axis] * cellCount, 0.f, cellCount - 1.f);
+			code |= spreadBits(static_cast<MortonCode>(cell)) << (2 - axis);
+		}
+		return code;
+	}
+}
+
+BVH::BVH(std::vector<Triangle>& triangles, const VertexBuffer& vertices, const BuildSettings& buildSettings,
+         std::vector<uint32_t>* triangleOrder)
+	: settings(buildSettings)
+{
+	Range range{0, static_cast<uint32_t>(triangles.size())};
+
+	// Spatial splits work on per-node reference lists and are built serially
+	const bool spatialSplits = settings.splitHeuristic == SplitHeuristic::SBVH;
+
+	std::unique_ptr<ThreadPool> threadPool;
+	if (settings.parallelBuild && !spatialSplits && range.count() >= parallelBuildMinPrimitiveCount)
+		threadPool = std::make_unique<ThreadPool>();
+
+	// Build over lightweight references so the partitioning does not have to move whole triangles around
+	std::vector<BuildPrimitive> primitives(range.count());
+	const uint32_t chunkCount = getChunkCount(range, threadPool.get(), parallelChunkMinPrimitiveCount);
+	forEachChunk(range, chunkCount, threadPool.get(), [&](uint32_t, Range chunk)
+	{
+		for (uint32_t triangleIndex = chunk.start; triangleIndex < chunk.end; ++triangleIndex)
+		{
+			const Triangle& triangle = triangles[triangleIndex];
+			primitives[triangleIndex] = {AABB(triangle, vertices), triangle.centroid(vertices), triangleIndex};
+		}
+	});
+
+	buildHierarchy(primitives, &triangles, &vertices, threadPool.get());
+
+	// Reorder the triangles so that every leaf references a contiguous range
+	std::vector<Triangle> orderedTriangles;
+	orderedTriangles.reserve(triangles.size());
+	for (const auto& primitive : primitives)
+		orderedTriangles.push_back(triangles[primitive.triangleIndex]);
+	triangles = std::move(orderedTriangles);
+
+	if (triangleOrder)
+	{
+		triangleOrder->clear();
+		triangleOrder->reserve(primitives.size());
+		for (const auto& primitive : primitives)
+			triangleOrder->push_back(primitive.triangleIndex);
+	}
+}
+
+BVH::BVH(const std::vector<AABB>& primitiveBounds, const BuildSettings& buildSettings,
+         std::vector<uint32_t>& primitiveOrder)
+	: settings(buildSettings)
+{
+	// Spatial splits clip triangles, plain boxes fall back to the binned SAH
+	if (settings.splitHeuristic == SplitHeuristic::SBVH)
+		settings.splitHeuristic = SplitHeuristic::SAH;
+
+	std::vector<BuildPrimitive> primitives;
+	primitives.reserve(primitiveBounds.size());
+	for (uint32_t primitiveIndex = 0; primitiveIndex < primitiveBounds.size(); ++primitiveIndex)
+	{
+		const AABB& boundingBox = primitiveBounds[primitiveIndex];
+		primitives.push_back({boundingBox, boundingBox.center(), primitiveIndex});
+	}
+
+	buildHierarchy(primitives, nullptr, nullptr, nullptr);
+
+	primitiveOrder.clear();
+	primitiveOrder.reserve(primitives.size());
+	for (const auto& primitive : primitives)
+		primitiveOrder.push_back(primitive.triangleIndex);
+}
+
+void BVH::buildHierarchy(std::vector<BuildPrimitive>& primitives, const std::vector<Triangle>* triangles,
+                         const VertexBuffer* vertices, ThreadPool* threadPool)
+{
+	settings.maxDepth = std::min(settings.maxDepth, maxStackDepth - 1);
+	settings.maxTriangleCountPerLeaf = std::min(settings.maxTriangleCountPerLeaf, maxLeafPrimitiveCount);
+	settings.sahBinCount = std::clamp(settings.sahBinCount, 2u, maxSAHBinCount);
+	if (!triangles || (settings.leafPackWidth != 4 && settings.leafPackWidth != 8))
+		settings.leafPackWidth = 0;
+
+	if (primitives.empty())
+		return;
+
+	// Leaves count their primitives in 16 bits, so a shallow maxDepth must still leave enough levels for the
+	// whole scene. The builders then keep every child within the capacity of the levels below it
+	const Range range{0, static_cast<uint32_t>(primitives.size())};
+	while (getSubtreeCapacity(0) < range.count())
+		++settings.maxDepth;
+
+	if (triangles && settings.splitHeuristic == SplitHeuristic::SBVH)
+	{
+		AABB rootBox;
+		AABB centroidBounds;
+		computeBounds(primitives, range, rootBox, centroidBounds, nullptr);
+
+		// Leaves append their references, duplicates become copies of the triangle when gathering
+		std::vector<BuildPrimitive> orderedPrimitives;
+		auto referenceBudget = static_cast<uint32_t>(static_cast<float>(range.count()) * settings.spatialSplitBudget);
+		orderedPrimitives.reserve(range.count() + referenceBudget);
+		buildSpatial(*triangles, *vertices, std::move(primitives), 0, rootBox.area(), referenceBudget, nodes,
+		             orderedPrimitives);
+		primitives = std::move(orderedPrimitives);
+	}
+	else if (settings.splitHeuristic == SplitHeuristic::LBVH)
+	{
+		// 30-bit codes give a 1024^3 grid, which gets too coarse to separate the primitives of larger scenes
+		if (range.count() <= linearBuild30BitMaxPrimitiveCount)
+			buildLinear<uint32_t>(primitives, threadPool);
+		else
+			buildLinear<uint64_t>(primitives, threadPool);
+	}
+	else if (threadPool)
+		buildParallel(primitives, *threadPool);
+	else
+		build(primitives, range, 0, nodes);
+
+	if (settings.leafPackWidth != 0)
+		alignLeaves(primitives);
+
+	builtSAHCost = computeSAHCost(nodes);
+	convertLayout();
+}
+
+void BVH::alignLeaves(std::vector<BuildPrimitive>& primitives)
+{
+	// The gaps are filled with copies of the last primitive of the previous leaf. No leaf references them, they
+	// only keep the triangle order valid and end up in the masked lanes of the packs
+	std::vector<BuildPrimitive> alignedPrimitives;
+	alignedPrimitives.reserve(primitives.size() + primitives.size() / 2);
+	for (BVHNode& node : nodes)
+	{
+		if (!node.isLeaf())
+			continue;
+
+		while (alignedPrimitives.size() % settings.leafPackWidth != 0)
+			alignedPrimitives.push_back(alignedPrimitives.back());
+
+		const auto first = primitives.begin() + node.primitivesOffset;
+		node.primitivesOffset = static_cast<uint32_t>(alignedPrimitives.size());
+		alignedPrimitives.insert(alignedPrimitives.end(), first, first + node.primitiveCount);
+	}
+	while (alignedPrimitives.size() % settings.leafPackWidth != 0)
+		alignedPrimitives.push_back(alignedPrimitives.back());
+
+	primitives = std::move(alignedPrimitives);
+}
+
+void BVH::convertLayout()
+{
+	if (settings.nodeLayout == NodeLayout::Binary)
+	{
+		pairSiblings();
+		reorderNodes();
+		return;
+	}
+
+	// The other layouts are converted from the depth-first binary tree, which is not needed afterwards
+
+	// Quantized boxes are padded by a few ulps of the scene coordinates, so that the rounding of the
+	// decoded parent bounds never cuts into a child
+	const AABB& rootBox = nodes[0].boundingBox;
+	Vector3 margin;
+	for (uint8_t axis = 0; axis < 3; ++axis)
+		margin[axis] = std::max(std::abs(rootBox.minPoint[axis]), std::abs(rootBox.maxPoint[axis])) * 1e-6f;
+	quantizedRootBox = AABB(rootBox.minPoint - margin * 2.f, rootBox.maxPoint + margin * 2.f);
+
+	switch (settings.nodeLayout)
+	{
+	case NodeLayout::Quantized8:
+		quantized8Nodes.resize(nodes.size());
+		quantize(0, quantizedRootBox, margin, quantized8Nodes);
+		break;
+	case NodeLayout::Quantized16:
+		quantized16Nodes.resize(nodes.size());
+		quantize(0, quantizedRootBox, margin, quantized16Nodes);
+		break;
+	case NodeLayout::Wide4:
+		wide4Nodes.emplace_back();
+		collapse(0, 0, wide4Nodes);
+		builtSAHCost = computeSAHCost(wide4Nodes);
+		break;
+	case NodeLayout::Wide8:
+	default:
+		wide8Nodes.emplace_back();
+		collapse(0, 0, wide8Nodes);
+		builtSAHCost = computeSAHCost(wide8Nodes);
+		break;
+	}
+	nodes = {};
+}
+
+void BVH::pairSiblings()
+{
+	// The build emits the first child right after its parent, which leaves the siblings far apart and ties the
+	// layout to the recursion. Storing both children next to each other fetches them in one cache line and
+	// lets the pairs be placed in any order, as long as children follow their parent
+	struct PendingNode
+	{
+		uint32_t nodeIndex;
+		uint32_t pairedIndex;
+	};
+
+	std::vector<BVHNode> pairedNodes;
+	pairedNodes.reserve(nodes.size());
+	pairedNodes.push_back(nodes[0]);
+
+	std::vector<PendingNode> pendingNodes{{0, 0}};
+	while (!pendingNodes.empty())
+	{
+		const PendingNode pendingNode = pendingNodes.back();
+		pendingNodes.pop_back();
+
+		const BVHNode& node = nodes[pendingNode.nodeIndex];
+		if (node.isLeaf())
+			continue;
+
+		const auto childrenOffset = static_cast<uint32_t>(pairedNodes.size());
+		pairedNodes.push_back(nodes[pendingNode.nodeIndex + 1]);
+		pairedNodes.push_back(nodes[node.secondChildOffset]);
+		pairedNodes[pendingNode.pairedIndex].childrenOffset = childrenOffset;
+
+		// Second child first, so that the pairs keep the depth-first order
+		pendingNodes.push_back({node.secondChildOffset, childrenOffset + 1});
+		pendingNodes.push_back({pendingNode.nodeIndex + 1, childrenOffset});
+	}
+
+	nodes = std::move(pairedNodes);
+}
+
+void BVH::reorderNodes(const std::vector<uint32_t>* nodeAccessCounts)
+{
+	if (settings.nodeLayout != NodeLayout::Binary || settings.nodeOrder == NodeOrder::DepthFirst || nodes.size() < 3)
+		return;
+
+	// Sibling pairs are the unit of the order, the root stays in front of them
+	std::vector<uint32_t> pairOrder;
+	pairOrder.reserve(nodes.size() / 2);
+	if (settings.nodeOrder == NodeOrder::VanEmdeBoas)
+	{
+		// Children follow their parent, so the depths are known before the children are reached
+		std::vector<uint8_t> nodeDepths(nodes.size(), 0);
+		uint32_t levelCount = 0;
+		for (uint32_t nodeIndex = 0; nodeIndex < nodes.size(); ++nodeIndex)
+		{
+			const BVHNode& node = nodes[nodeIndex];
+			if (node.isLeaf())
+				continue;
+
+			const auto childDepth = static_cast<uint8_t>(nodeDepths[nodeIndex] + 1);
+			nodeDepths[node.childrenOffset] = childDepth;
+			nodeDepths[node.childrenOffset + 1] = childDepth;
+			levelCount = std::max<uint32_t>(levelCount, childDepth);
+		}
+
+		std::vector<uint32_t> belowPairs;
+		emitVanEmdeBoas(nodes[0].childrenOffset, levelCount, pairOrder, belowPairs);
+	}
+	else
+	{
+		orderByAccessFrequency(nodeAccessCounts, pairOrder);
+	}
+
+	std::vector<uint32_t> orderedIndices(nodes.size(), 0);
+	std::vector<BVHNode> orderedNodes;
+	orderedNodes.reserve(nodes.size());
+	orderedNodes.push_back(nodes[0]);
+	for (uint32_t pairIndex : pairOrder)
+	{
+		for (uint32_t sibling = 0; sibling < 2; ++sibling)
+		{
+			orderedIndices[pairIndex + sibling] = static_cast<uint32_t>(orderedNodes.size());
+			orderedNodes.push_back(nodes[pairIndex + sibling]);
+		}
+	}
+
+	for (auto& node : orderedNodes)
+	{
+		if (!node.isLeaf())
+			node.childrenOffset = orderedIndices[node.childrenOffset];
+	}
+	nodes = std::move(orderedNodes);
+}
+
+void BVH::emitVanEmdeBoas(uint32_t pairIndex, uint32_t levelCount, std::vector<uint32_t>& pairOrder,
+                          std::vector<uint32_t>& belowPairs) const
+{
+	// Emits levelCount levels of pairs below pairIndex and collects the pairs right below them. The top half
+	// of the levels is emitted first, then every subtree hanging off it, both recursively
+	if (levelCount == 1)
+	{
+		pairOrder.push_back(pairIndex);
+		for (uint32_t sibling = 0; sibling < 2; ++sibling)
+		{
+			const BVHNode& node = nodes[pairIndex + sibling];
+			if (!node.isLeaf())
+				belowPairs.push_back(node.childrenOffset);
+		}
+		return;
+	}
+
+	const uint32_t topLevelCount = levelCount / 2;
+	std::vector<uint32_t> middlePairs;
+	emitVanEmdeBoas(pairIndex, topLevelCount, pairOrder, middlePairs);
+	for (uint32_t middlePair : middlePairs)
+		emitVanEmdeBoas(middlePair, levelCount - topLevelCount, pairOrder, belowPairs);
+}
+
+void BVH::orderByAccessFrequency(const std::vector<uint32_t>* nodeAccessCounts,
+                                 std::vector<uint32_t>& pairOrder) const
+{
+	// Both siblings are fetched whenever the ray enters their parent, so a pair is ranked by the accesses of
+	// the parent, or by its area, which is proportional to the probability of a random ray hitting it. The
+	// ranks never grow towards the leaves, so emitting the best ranked pair of the front is a valid order
+	struct RankedPair
+	{
+		uint32_t accessCount;
+		float area;
+		uint32_t pairIndex;
+
+		bool operator<(const RankedPair& other) const
+		{
+			if (accessCount != other.accessCount)
+				return accessCount < other.accessCount;
+			if (area != other.area)
+				return area < other.area;
+			return pairIndex > other.pairIndex;
+		}
+	};
+
+	const auto rankPair = [&](uint32_t parentIndex) -> RankedPair
+	{
+		const BVHNode& parent = nodes[parentIndex];
+		const uint32_t accessCount = nodeAccessCounts && parentIndex < nodeAccessCounts->size()
+			? (*nodeAccessCounts)[parentIndex]
+			: 0;
+		return {accessCount, parent.boundingBox.area(), parent.childrenOffset};
+	};
+
+	std::priority_queue<RankedPair> frontPairs;
+	frontPairs.push(rankPair(0));
+	while (!frontPairs.empty())
+	{
+		const uint32_t pairIndex = frontPairs.top().pairIndex;
+		frontPairs.pop();
+		pairOrder.push_back(pairIndex);
+
+		for (uint32_t sibling = 0; sibling < 2; ++sibling)
+		{
+			if (!nodes[pairIndex + sibling].isLeaf())
+				frontPairs.push(rankPair(pairIndex + sibling));
+		}
+	}
+}
+
+bool BVH::refit(const std::vector<Triangle>& triangles, const VertexBuffer& vertices)
+{
+	if (triangles.empty())
+		return true;
+
+	float sahCost = 0.f;
+	switch (settings.nodeLayout)
+	{
+	case NodeLayout::Quantized8:
+		refitQuantized(triangles, vertices, quantized8Nodes);
+		sahCost = computeSAHCost(nodes);
+		convertLayout();
+		break;
+	case NodeLayout::Quantized16:
+		refitQuantized(triangles, vertices, quantized16Nodes);
+		sahCost = computeSAHCost(nodes);
+		convertLayout();
+		break;
+	case NodeLayout::Wide4:
+		refitWide(triangles, vertices, wide4Nodes);
+		sahCost = computeSAHCost(wide4Nodes);
+		break;
+	case NodeLayout::Wide8:
+		refitWide(triangles, vertices, wide8Nodes);
+		sahCost = computeSAHCost(wide8Nodes);
+		break;
+	case NodeLayout::Binary:
+	default:
+		refitBinary(triangles, vertices);
+		sahCost = computeSAHCost(nodes);
+		break;
+	}
+
+	return sahCost <= builtSAHCost * (1.f + settings.refitRebuildThreshold);
+}
+
+void BVH::build(std::vector<BuildPrimitive>& primitives, Range range, uint32_t depth,
+                std::vector<BVHNode>& outNodes) const
+{
+	AABB boundingBox;
+	AABB centroidBounds;
+	computeBounds(primitives, range, boundingBox, centroidBounds, nullptr);
+
+	if (depth >= settings.maxDepth || range.count() <= settings.maxTriangleCountPerLeaf)
+	{
+		// Create leaf node
+		BVHNode leafNode{
+			.boundingBox = boundingBox,
+			.primitivesOffset = range.start,
+			.primitiveCount = static_cast<uint16_t>(range.count())
+		};
+		outNodes.emplace_back(leafNode);
+		return;
+	}
+
+	uint8_t splitAxis;
+	uint32_t mid = split(primitives, range, depth, boundingBox, centroidBounds, splitAxis, nullptr);
+
+	BVHNode interiorNode{
+		.boundingBox = boundingBox,
+		.primitiveCount = 0,
+		.splitAxis = splitAxis
+	};
+
+	uint32_t interiorNodeIndex = static_cast<uint32_t>(outNodes.size());
+	outNodes.emplace_back(interiorNode);
+
+	build(primitives, Range{range.start, mid}, depth + 1, outNodes);
+
+	outNodes[interiorNodeIndex].secondChildOffset = static_cast<uint32_t>(outNodes.size());
+
+	build(primitives, Range{mid, range.end}, depth + 1, outNodes);
+}
+
+void BVH::buildParallel(std::vector<BuildPrimitive>& primitives, ThreadPool& threadPool)
+{
+	const auto primitiveCount = static_cast<uint32_t>(primitives.size());
+	const auto threadCount = static_cast<uint32_t>(threadPool.GetThreadCount());
+	const uint32_t subtreeTaskSize = std::max(subtreeTaskMinPrimitiveCount, primitiveCount / (threadCount * 8));
+
+	// Split the top of the tree on this thread, using the pool for the large bounds/binning/partition passes
+	std::vector<TopLevelNode> topLevelNodes;
+	std::vector<SubtreeTask> subtreeTasks;
+	int32_t root = buildTopLevel(primitives, Range{0, primitiveCount}, 0, subtreeTaskSize, topLevelNodes,
+	                             subtreeTasks, threadPool);
+
+	// Subtrees cover disjoint primitive ranges, so they are built concurrently into their own node blocks.
+	// Start with the largest ones so that the pool does not end up waiting for a big task taken last
+	std::vector<uint32_t> taskOrder(subtreeTasks.size());
+	std::iota(taskOrder.begin(), taskOrder.end(), 0);
+	std::ranges::sort(taskOrder, [&subtreeTasks](uint32_t a, uint32_t b)
+	{
+		return subtreeTasks[a].range.count() > subtreeTasks[b].range.count();
+	});
+
+	threadPool.ParallelFor(0, static_cast<uint32_t>(taskOrder.size()), 1, [&](uint32_t first, uint32_t last)
+	{
+		for (uint32_t orderIndex = first; orderIndex < last; ++orderIndex)
+		{
+			SubtreeTask& task = subtreeTasks[taskOrder[orderIndex]];
+			build(primitives, task.range, task.depth, task.nodes);
+		}
+	});
+
+	// Stitch the top nodes and the subtree blocks together into the depth-first node array
+	size_t nodeCount = topLevelNodes.size();
+	for (const auto& task : subtreeTasks)
+		nodeCount += task.nodes.size();
+
+	nodes.reserve(nodeCount);
+	emitTopLevel(root, topLevelNodes, subtreeTasks);
+}
+
+void BVH::buildSpatial(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+                       std::vector<BuildPrimitive> references, uint32_t depth, float rootArea, uint32_t referenceBudget,
+                       std::vector<BVHNode>& outNodes, std::vector<BuildPrimitive>& outPrimitives) const
+{
+	const Range range{0, static_cast<uint32_t>(references.size())};
+
+	AABB boundingBox;
+	AABB centroidBounds;
+	computeBounds(references, range, boundingBox, centroidBounds, nullptr);
+
+	if (depth >= settings.maxDepth || range.count() <= settings.maxTriangleCountPerLeaf)
+	{
+		// Create leaf node
+		BVHNode leafNode{
+			.boundingBox = boundingBox,
+			.primitivesOffset = static_cast<uint32_t>(outPrimitives.size()),
+			.primitiveCount = static_cast<uint16_t>(range.count())
+		};
+		outNodes.emplace_back(leafNode);
+		outPrimitives.insert(outPrimitives.end(), references.begin(), references.end());
+		return;
+	}
+
+	// Start from the object split, a spatial split is only considered when its children overlap noticeably
+	uint8_t splitAxis;
+	const uint32_t mid = split(references, range, depth, boundingBox, centroidBounds, splitAxis, nullptr);
+
+	AABB leftBox;
+	AABB rightBox;
+	AABB unusedCentroidBounds;
+	computeBounds(references, Range{0, mid}, leftBox, unusedCentroidBounds, nullptr);
+	computeBounds(references, Range{mid, range.end}, rightBox, unusedCentroidBounds, nullptr);
+
+	std::vector<BuildPrimitive> leftReferences;
+	std::vector<BuildPrimitive> rightReferences;
+	if (referenceBudget > 0 && leftBox.overlaps(rightBox) &&
+		AABB(leftBox).intersection(rightBox).area() > settings.spatialSplitAlpha * rootArea)
+	{
+		const float objectCost = static_cast<float>(mid) * leftBox.area() +
+			static_cast<float>(range.end - mid) * rightBox.area();
+
+		std::optional<SpatialSplit> spatialSplit = findSpatialSplit(triangles, vertices, references, boundingBox,
+		                                                            referenceBudget);
+		if (spatialSplit.has_value() && spatialSplit->cost < objectCost)
+		{
+			splitSpatial(triangles, vertices, references, *spatialSplit, leftReferences, rightReferences);
+			const uint64_t childCapacity = getSubtreeCapacity(depth + 1);
+			if (!leftReferences.empty() && !rightReferences.empty() && leftReferences.size() <= childCapacity &&
+				rightReferences.size() <= childCapacity)
+			{
+				const auto duplicateCount = static_cast<uint32_t>(
+					leftReferences.size() + rightReferences.size() - references.size());
+				referenceBudget -= std::min(referenceBudget, duplicateCount);
+				splitAxis = spatialSplit->axis;
+			}
+			else
+			{
+				leftReferences.clear();
+				rightReferences.clear();
+			}
+		}
+	}
+
+	if (leftReferences.empty())
+	{
+		leftReferences.assign(references.begin(), references.begin() + mid);
+		rightReferences.assign(references.begin() + mid, references.end());
+	}
+
+	// Release this node's references before going deeper
+	references = {};
+
+	// Share the remaining budget by reference count, so that the first subtree built does not use it all up
+	const uint64_t leftCount = leftReferences.size();
+	const uint64_t rightCount = rightReferences.size();
+	const auto leftBudget = static_cast<uint32_t>(referenceBudget * leftCount / (leftCount + rightCount));
+	const uint32_t rightBudget = referenceBudget - leftBudget;
+
+	BVHNode interiorNode{
+		.boundingBox = boundingBox,
+		.primitiveCount = 0,
+		.splitAxis = splitAxis
+	};
+
+	uint32_t interiorNodeIndex = static_cast<uint32_t>(outNodes.size());
+	outNodes.emplace_back(interiorNode);
+
+	buildSpatial(triangles, vertices, std::move(leftReferences), depth + 1, rootArea, leftBudget, outNodes,
+	             outPrimitives);
+
+	outNodes[interiorNodeIndex].secondChildOffset = static_cast<uint32_t>(outNodes.size());
+
+	buildSpatial(triangles, vertices, std::move(rightReferences), depth + 1, rootArea, rightBudget, outNodes,
+	             outPrimitives);
+}
+
+template <typename MortonCode>
+void BVH::buildLinear(std::vector<BuildPrimitive>& primitives, ThreadPool* threadPool)
+{
+	const Range range{0, static_cast<uint32_t>(primitives.size())};
+	const uint32_t chunkCount = getChunkCount(range, threadPool, parallelChunkMinPrimitiveCount);
+
+	AABB boundingBox;
+	AABB centroidBounds;
+	computeBounds(primitives, range, boundingBox, centroidBounds, threadPool);
+
+	const Vector3 centroidExtent = centroidBounds.extent();
+	Vector3 centroidScale;
+	for (uint8_t axis = 0; axis < 3; ++axis)
+		centroidScale[axis] = centroidExtent[axis] > 0.f ? 1.f / centroidExtent[axis] : 0.f;
+
+	std::vector<MortonPrimitive<MortonCode>> mortonPrimitives(range.count());
+	forEachChunk(range, chunkCount, threadPool, [&](uint32_t, Range chunk)
+	{
+		for (uint32_t primitiveIndex = chunk.start; primitiveIndex < chunk.end; ++primitiveIndex)
+		{
+			const Vector3 relativePosition = (primitives[primitiveIndex].centroid - centroidBounds.minPoint) *
+				centroidScale;
+			mortonPrimitives[primitiveIndex] = {encodeMorton<MortonCode>(relativePosition), primitiveIndex};
+		}
+	});
+
+	radixSort(mortonPrimitives, threadPool);
+
+	std::vector<BuildPrimitive> sortedPrimitives(range.count());
+	std::vector<MortonCode> mortonCodes(range.count());
+	forEachChunk(range, chunkCount, threadPool, [&](uint32_t, Range chunk)
+	{
+		for (uint32_t sortedIndex = chunk.start; sortedIndex < chunk.end; ++sortedIndex)
+		{
+			sortedPrimitives[sortedIndex] = primitives[mortonPrimitives[sortedIndex].primitiveIndex];
+			mortonCodes[sortedIndex] = mortonPrimitives[sortedIndex].code;
+		}
+	});
+
+	std::vector<LinearNode> linearNodes;
+	linearNodes.reserve(2 * range.count() / std::max(settings.maxTriangleCountPerLeaf, 1u) + 1);
+	const uint32_t rootIndex = emitLinear(mortonCodes, sortedPrimitives, range, 0, linearNodes);
+
+	if (settings.treeletOptimization)
+		optimizeTreelets(linearNodes, rootIndex, threadPool);
+
+	// Restructured treelets move leaves between subtrees, so the primitives are gathered in the final leaf order
+	std::vector<BuildPrimitive> orderedPrimitives;
+	orderedPrimitives.reserve(range.count());
+	nodes.reserve(linearNodes.size());
+	flattenLinear(linearNodes, rootIndex, sortedPrimitives, orderedPrimitives);
+	primitives = std::move(orderedPrimitives);
+}
+
+template <typename MortonCode>
+void BVH::radixSort(std::vector<MortonPrimitive<MortonCode>>& mortonPrimitives, ThreadPool* threadPool)
+{
+	constexpr uint32_t digitCount = 1u << radixDigitBits;
+	const Range range{0, static_cast<uint32_t>(mortonPrimitives.size())};
+	const uint32_t chunkCount = getChunkCount(range, threadPool, parallelChunkMinPrimitiveCount);
+
+	std::vector<MortonPrimitive<MortonCode>> sortedPrimitives(range.count());
+	std::vector<std::array<uint32_t, digitCount>> chunkOffsets(chunkCount);
+	for (uint32_t shift = 0; shift < sizeof(MortonCode) * 8; shift += radixDigitBits)
+	{
+		auto getDigit = [shift](const MortonPrimitive<MortonCode>& mortonPrimitive)
+		{
+			return static_cast<uint32_t>(mortonPrimitive.code >> shift) & (digitCount - 1);
+		};
+
+		forEachChunk(range, chunkCount, threadPool, [&](uint32_t chunkIndex, Range chunk)
+		{
+			std::array<uint32_t, digitCount>& histogram = chunkOffsets[chunkIndex];
+			histogram.fill(0);
+			for (uint32_t index = chunk.start; index < chunk.end; ++index)
+				++histogram[getDigit(mortonPrimitives[index])];
+		});
+
+		// Digit-major exclusive prefix sum, every chunk scatters after the chunks before it so the sort is stable.
+		// Passes over a digit shared by all codes (the unused top bits) are skipped
+		bool sharedDigit = false;
+		uint32_t offset = 0;
+		for (uint32_t digit = 0; digit < digitCount; ++digit)
+		{
+			const uint32_t digitStart = offset;
+			for (auto& offsets : chunkOffsets)
+			{
+				const uint32_t count = offsets[digit];
+				offsets[digit] = offset;
+				offset += count;
+			}
+			sharedDigit = sharedDigit || offset - digitStart == range.count();
+		}
+
+		if (sharedDigit)
+			continue;
+
+		forEachChunk(range, chunkCount, threadPool, [&](uint32_t chunkIndex, Range chunk)
+		{
+			std::array<uint32_t, digitCount>& offsets = chunkOffsets[chunkIndex];
+			for (uint32_t index = chunk.start; index < chunk.end; ++index)
+				sortedPrimitives[offsets[getDigit(mortonPrimitives[index])]++] = mortonPrimitives[index];
+		});
+		mortonPrimitives.swap(sortedPrimitives);
+	}
+}
+
+template <typename MortonCode>
+uint32_t BVH::emitLinear(const std::vector<MortonCode>& mortonCodes, const std::vector<BuildPrimitive>& primitives,
+                         Range range, uint32_t depth, std::vector<LinearNode>& linearNodes) const
+{
+	LinearNode node{};
+	if (depth >= settings.maxDepth || range.count() <= settings.maxTriangleCountPerLeaf)
+	{
+		for (uint32_t primitiveIndex = range.start; primitiveIndex < range.end; ++primitiveIndex)
+			node.boundingBox |= primitives[primitiveIndex].boundingBox;
+		node.range = range;
+		node.cost = node.boundingBox.area() * static_cast<float>(range.count());
+
+		linearNodes.push_back(node);
+		return static_cast<uint32_t>(linearNodes.size() - 1);
+	}
+
+	// Split where the highest bit that differs within the range flips, the codes above it are shared
+	uint32_t mid = range.start + range.count() / 2;
+	const MortonCode firstCode = mortonCodes[range.start];
+	const MortonCode lastCode = mortonCodes[range.end - 1];
+	if (firstCode != lastCode)
+	{
+		const auto splitBit = static_cast<uint32_t>(std::bit_width(firstCode ^ lastCode) - 1);
+		node.splitAxis = static_cast<uint8_t>(2 - splitBit % 3);
+
+		const MortonCode splitMask = MortonCode{1} << splitBit;
+		auto first = mortonCodes.begin() + range.start;
+		auto last = mortonCodes.begin() + range.end;
+		const auto mortonMid = static_cast<uint32_t>(std::distance(mortonCodes.begin(), std::partition_point(
+			first, last, [splitMask](MortonCode code) { return (code & splitMask) == 0; })));
+
+		// Keep the Morton split only while the larger side still fits into the remaining depth, otherwise
+		// fall back to the median, which never runs out of levels
+		const uint64_t childCapacity = static_cast<uint64_t>(settings.maxTriangleCountPerLeaf) <<
+			(settings.maxDepth - depth - 1);
+		if (std::max(mortonMid - range.start, range.end - mortonMid) <= childCapacity)
+			mid = mortonMid;
+	}
+
+	node.children[0] = emitLinear(mortonCodes, primitives, Range{range.start, mid}, depth + 1, linearNodes);
+	node.children[1] = emitLinear(mortonCodes, primitives, Range{mid, range.end}, depth + 1, linearNodes);
+
+	const LinearNode& left = linearNodes[node.children[0]];
+	const LinearNode& right = linearNodes[node.children[1]];
+	node.boundingBox = left.boundingBox;
+	node.boundingBox |= right.boundingBox;
+	node.range = Range{0, 0};
+	node.height = std::max(left.height, right.height) + 1;
+	node.cost = node.boundingBox.area() + left.cost + right.cost;
+
+	linearNodes.push_back(node);
+	return static_cast<uint32_t>(linearNodes.size() - 1);
+}
+
+void BVH::optimizeTreelets(std::vector<LinearNode>& linearNodes, uint32_t rootIndex, ThreadPool* threadPool) const
+{
+	// Subtrees at taskDepth are optimized concurrently, the levels above them once those are done
+	const uint32_t taskDepth = threadPool
+		? static_cast<uint32_t>(std::bit_width(threadPool->GetThreadCount() * 4))
+		: std::numeric_limits<uint32_t>::max();
+
+	std::vector<uint32_t> taskRoots;
+	for (uint32_t pass = 0; pass < treeletPassCount; ++pass)
+	{
+		// Collected again every pass, restructuring the top levels moves nodes across taskDepth
+		taskRoots.clear();
+		std::vector<std::pair<uint32_t, uint32_t>> nodesToVisit{{rootIndex, 0}};
+		while (threadPool && !nodesToVisit.empty())
+		{
+			auto [nodeIndex, depth] = nodesToVisit.back();
+			nodesToVisit.pop_back();
+
+			const LinearNode& node = linearNodes[nodeIndex];
+			if (node.isLeaf())
+				continue;
+
+			if (depth == taskDepth)
+			{
+				taskRoots.push_back(nodeIndex);
+				continue;
+			}
+
+			nodesToVisit.emplace_back(node.children[0], depth + 1);
+			nodesToVisit.emplace_back(node.children[1], depth + 1);
+		}
+
+		const Range taskRange{0, static_cast<uint32_t>(taskRoots.size())};
+		forEachChunk(taskRange, std::max(taskRange.count(), 1u), threadPool, [&](uint32_t, Range chunk)
+		{
+			for (uint32_t taskIndex = chunk.start; taskIndex < chunk.end; ++taskIndex)
+			{
+				optimizeTreeletsBelow(linearNodes, taskRoots[taskIndex], taskDepth,
+				                      std::numeric_limits<uint32_t>::max());
+			}
+		});
+
+		optimizeTreeletsBelow(linearNodes, rootIndex, 0, taskDepth);
+	}
+}
+
+void BVH::optimizeTreeletsBelow(std::vector<LinearNode>& linearNodes, uint32_t nodeIndex, uint32_t depth,
+                                uint32_t stopDepth) const
+{
+	if (linearNodes[nodeIndex].isLeaf() || depth >= stopDepth)
+		return;
+
+	// Bottom-up, so that every treelet is formed over already optimized subtrees
+	optimizeTreeletsBelow(linearNodes, linearNodes[nodeIndex].children[0], depth + 1, stopDepth);
+	optimizeTreeletsBelow(linearNodes, linearNodes[nodeIndex].children[1], depth + 1, stopDepth);
+	optimizeTreelet(linearNodes, nodeIndex, depth);
+}
+
+bool BVH::optimizeTreelet(std::vector<LinearNode>& linearNodes, uint32_t rootIndex, uint32_t depth) const
+{
+	// Grow the treelet by opening its largest leaf until it has treeletLeafCount leaves, the opened nodes are
+	// reused for the new topology
+	std::array<uint32_t, treeletLeafCount> treeletLeaves;
+	std::array<uint32_t, treeletLeafCount - 1> treeletInteriors;
+	uint32_t leafCount = 2;
+	uint32_t interiorCount = 1;
+	treeletLeaves[0] = linearNodes[rootIndex].children[0];
+	treeletLeaves[1] = linearNodes[rootIndex].children[1];
+	treeletInteriors[0] = rootIndex;
+	while (leafCount < treeletLeafCount)
+	{
+		std::optional<uint32_t> largestSlot;
+		float largestArea = 0.f;
+		for (uint32_t slot = 0; slot < leafCount; ++slot)
+		{
+			const LinearNode& node = linearNodes[treeletLeaves[slot]];
+			if (!node.isLeaf() && (!largestSlot.has_value() || node.boundingBox.area() > largestArea))
+			{
+				largestSlot = slot;
+				largestArea = node.boundingBox.area();
+			}
+		}
+
+		if (!largestSlot.has_value())
+			break;
+
+		const uint32_t openedIndex = treeletLeaves[*largestSlot];
+		treeletInteriors[interiorCount++] = openedIndex;
+		treeletLeaves[*largestSlot] = linearNodes[openedIndex].children[0];
+		treeletLeaves[leafCount++] = linearNodes[openedIndex].children[1];
+	}
+
+	// Two leaves have a single topology
+	if (leafCount < 3)
+		return false;
+
+	// Optimal SAH cost of every subset of the treelet leaves, built up from the smaller subsets
+	constexpr uint32_t maxSubsetCount = 1u << treeletLeafCount;
+	std::array<AABB, maxSubsetCount> subsetBoxes;
+	std::array<float, maxSubsetCount> subsetCosts;
+	std::array<uint32_t, maxSubsetCount> subsetHeights;
+	std::array<uint8_t, maxSubsetCount> subsetPartitions;
+	const uint32_t fullSubset = (1u << leafCount) - 1;
+	for (uint32_t subset = 1; subset <= fullSubset; ++subset)
+	{
+		const uint32_t lowestLeaf = std::countr_zero(subset);
+		if (std::has_single_bit(subset))
+		{
+			const LinearNode& leaf = linearNodes[treeletLeaves[lowestLeaf]];
+			subsetBoxes[subset] = leaf.boundingBox;
+			subsetCosts[subset] = leaf.cost;
+			subsetHeights[subset] = leaf.height;
+			continue;
+		}
+
+		subsetBoxes[subset] = subsetBoxes[subset & (subset - 1)];
+		subsetBoxes[subset] |= subsetBoxes[1u << lowestLeaf];
+
+		// Partitions keep the lowest leaf on the left, which skips the mirrored ones
+		float bestCost = std::numeric_limits<float>::max();
+		for (uint32_t left = (subset - 1) & subset; left != 0; left = (left - 1) & subset)
+		{
+			if ((left & (1u << lowestLeaf)) == 0)
+				continue;
+
+			const float cost = subsetCosts[left] + subsetCosts[subset ^ left];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				subsetPartitions[subset] = static_cast<uint8_t>(left);
+			}
+		}
+
+		const uint32_t left = subsetPartitions[subset];
+		subsetCosts[subset] = subsetBoxes[subset].area() + bestCost;
+		subsetHeights[subset] = std::max(subsetHeights[left], subsetHeights[subset ^ left]) + 1;
+	}
+
+	// Keep the old topology unless it gets cheaper, and never push leaves below the maximal depth
+	LinearNode& root = linearNodes[rootIndex];
+	if (subsetCosts[fullSubset] >= root.cost || depth + subsetHeights[fullSubset] > settings.maxDepth)
+		return false;
+
+	uint32_t nextInterior = 0;
+	auto restructure = [&](auto&& self, uint32_t subset) -> uint32_t
+	{
+		if (std::has_single_bit(subset))
+			return treeletLeaves[std::countr_zero(subset)];
+
+		const uint32_t nodeIndex = treeletInteriors[nextInterior++];
+		const uint32_t left = subsetPartitions[subset];
+		const uint32_t leftIndex = self(self, left);
+		const uint32_t rightIndex = self(self, subset ^ left);
+
+		// Split along the axis that separates the children the most
+		const Vector3 centerOffset = linearNodes[rightIndex].boundingBox.center() -
+			linearNodes[leftIndex].boundingBox.center();
+		uint8_t splitAxis = 0;
+		for (uint8_t axis = 1; axis < 3; ++axis)
+		{
+			if (std::abs(centerOffset[axis]) > std::abs(centerOffset[splitAxis]))
+				splitAxis = axis;
+		}
+
+		LinearNode& node = linearNodes[nodeIndex];
+		node.boundingBox = subsetBoxes[subset];
+		node.children[0] = leftIndex;
+		node.children[1] = rightIndex;
+		node.height = subsetHeights[subset];
+		node.cost = subsetCosts[subset];
+		node.splitAxis = splitAxis;
+		return nodeIndex;
+	};
+	restructure(restructure, fullSubset);
+	return true;
+}
+
+void BVH::flattenLinear(const std::vector<LinearNode>& linearNodes, uint32_t linearNodeIndex,
+                        const std::vector<BuildPrimitive>& primitives, std::vector<BuildPrimitive>& outPrimitives)
+{
+	const LinearNode& linearNode = linearNodes[linearNodeIndex];
+	if (linearNode.isLeaf())
+	{
+		BVHNode leafNode{
+			.boundingBox = linearNode.boundingBox,
+			.primitivesOffset = static_cast<uint32_t>(outPrimitives.size()),
+			.primitiveCount = static_cast<uint16_t>(linearNode.range.count())
+		};
+		nodes.emplace_back(leafNode);
+		outPrimitives.insert(outPrimitives.end(), primitives.begin() + linearNode.range.start,
+		                     primitives.begin() + linearNode.range.end);
+		return;
+	}
+
+	BVHNode interiorNode{
+		.boundingBox = linearNode.boundingBox,
+		.primitiveCount = 0,
+		.splitAxis = linearNode.splitAxis
+	};
+
+	const auto interiorNodeIndex = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back(interiorNode);
+
+	flattenLinear(linearNodes, linearNode.children[0], primitives, outPrimitives);
+	nodes[interiorNodeIndex].secondChildOffset = static_cast<uint32_t>(nodes.size());
+	flattenLinear(linearNodes, linearNode.children[1], primitives, outPrimitives);
+}
+
+int32_t BVH::buildTopLevel(std::vector<BuildPrimitive>& primitives, Range range, uint32_t depth,
+                           uint32_t subtreeTaskSize, std::vector<TopLevelNode>& topLevelNodes,
+                           std::vector<SubtreeTask>& subtreeTasks, ThreadPool& threadPool) const
+{
+	if (range.count() <= subtreeTaskSize || depth >= settings.maxDepth)
+	{
+		subtreeTasks.push_back({range, depth, {}});
+		return ~static_cast<int32_t>(subtreeTasks.size() - 1);
+	}
+
+	AABB boundingBox;
+	AABB centroidBounds;
+	computeBounds(primitives, range, boundingBox, centroidBounds, &threadPool);
+
+	uint8_t splitAxis;
+	uint32_t mid = split(primitives, range, depth, boundingBox, centroidBounds, splitAxis, &threadPool);
+
+	auto topLevelIndex = static_cast<int32_t>(topLevelNodes.size());
+	topLevelNodes.push_back({boundingBox, splitAxis, {}});
+
+	int32_t firstChild = buildTopLevel(primitives, Range{range.start, mid}, depth + 1, subtreeTaskSize,
+	                                   topLevelNodes, subtreeTasks, threadPool);
+	int32_t secondChild = buildTopLevel(primitives, Range{mid, range.end}, depth + 1, subtreeTaskSize,
+	                                    topLevelNodes, subtreeTasks, threadPool);
+
+	topLevelNodes[topLevelIndex].children[0] = firstChild;
+	topLevelNodes[topLevelIndex].children[1] = secondChild;
+	return topLevelIndex;
+}
+
+void BVH::emitTopLevel(int32_t topLevelIndex, std::vector<TopLevelNode>& topLevelNodes,
+                       std::vector<SubtreeTask>& subtreeTasks)
+{
+	if (topLevelIndex < 0)
+	{
+		// Subtree block, its interior links are relative to the start of the block
+		SubtreeTask& task = subtreeTasks[~topLevelIndex];
+		const auto blockOffset = static_cast<uint32_t>(nodes.size());
+		for (BVHNode node : task.nodes)
+		{
+			if (!node.isLeaf())
+				node.secondChildOffset += blockOffset;
+			nodes.push_back(node);
+		}
+		task.nodes = {};
+		return;
+	}
+
+	const TopLevelNode& topLevelNode = topLevelNodes[topLevelIndex];
+	BVHNode interiorNode{
+		.boundingBox = topLevelNode.boundingBox,
+		.primitiveCount = 0,
+		.splitAxis = topLevelNode.splitAxis
+	};
+
+	uint32_t interiorNodeIndex = static_cast<uint32_t>(nodes.size());
+	nodes.emplace_back(interiorNode);
+
+	emitTopLevel(topLevelNode.children[0], topLevelNodes, subtreeTasks);
+
+	nodes[interiorNodeIndex].secondChildOffset = static_cast<uint32_t>(nodes.size());
+
+	emitTopLevel(topLevelNode.children[1], topLevelNodes, subtreeTasks);
+}
+
+template <typename T>
+void BVH::quantize(uint32_t nodeIndex, const AABB& parentBox, const Vector3& margin,
+                   std::vector<QuantizedBVHNode<T>>& quantizedNodes) const
+{
+	const BVHNode& node = nodes[nodeIndex];
+	QuantizedBVHNode<T>& quantizedNode = quantizedNodes[nodeIndex];
+	quantizedNode.primitivesOffset = node.primitivesOffset;
+	quantizedNode.primitiveCount = node.primitiveCount;
+	quantizedNode.splitAxis = node.splitAxis;
+	quantizedNode.encode(AABB(node.boundingBox.minPoint - margin, node.boundingBox.maxPoint + margin), parentBox);
+
+	if (node.isLeaf())
+		return;
+
+	// Children are encoded against the box the traversal will decode, not the exact one
+	const AABB boundingBox = quantizedNode.decode(parentBox);
+	quantize(nodeIndex + 1, boundingBox, margin, quantizedNodes);
+	quantize(node.secondChildOffset, boundingBox, margin, quantizedNodes);
+}
+
+template <uint32_t Width>
+void BVH::collapse(uint32_t nodeIndex, uint32_t wideNodeIndex, std::vector<WideBVHNode<Width>>& wideNodes) const
+{
+	std::array<uint32_t, Width> children;
+	uint32_t childCount = 0;
+
+	const BVHNode& node = nodes[nodeIndex];
+	if (node.isLeaf())
+	{
+		// Only happens for a leaf root
+		children[childCount++] = nodeIndex;
+	}
+	else
+	{
+		children[childCount++] = nodeIndex + 1;
+		children[childCount++] = node.secondChildOffset;
+	}
+
+	// Pull grandchildren up by opening the largest interior child until the wide node is full
+	while (childCount < Width)
+	{
+		std::optional<uint32_t> largestSlot;
+		float largestArea = 0.f;
+		for (uint32_t slot = 0; slot < childCount; ++slot)
+		{
+			const BVHNode& child = nodes[children[slot]];
+			if (child.isLeaf())
+				continue;
+
+			const float area = child.boundingBox.area();
+			if (!largestSlot.has_value() || area > largestArea)
+			{
+				largestSlot = slot;
+				largestArea = area;
+			}
+		}
+
+		if (!largestSlot.has_value())
+			break;
+
+		const uint32_t openedIndex = children[*largestSlot];
+		children[*largestSlot] = openedIndex + 1;
+		children[childCount++] = nodes[openedIndex].secondChildOffset;
+	}
+
+	wideNodes[wideNodeIndex].childCount = static_cast<uint8_t>(childCount);
+	for (uint32_t slot = 0; slot < childCount; ++slot)
+	{
+		const BVHNode& child = nodes[children[slot]];
+		if (child.isLeaf())
+		{
+			wideNodes[wideNodeIndex].setChild(slot, child.boundingBox, child.primitivesOffset, child.primitiveCount);
+			continue;
+		}
+
+		// Index instead of a reference, emplace_back may reallocate
+		const auto childWideNodeIndex = static_cast<uint32_t>(wideNodes.size());
+		wideNodes.emplace_back();
+		wideNodes[wideNodeIndex].setChild(slot, child.boundingBox, childWideNodeIndex, 0);
+		collapse(children[slot], childWideNodeIndex, wideNodes);
+	}
+}
+
+void BVH::refitBinary(const std::vector<Triangle>& triangles, const VertexBuffer& vertices)
+{
+	// Children always follow their parent in every node order, so a reverse sweep updates them first. The
+	// nodes refitted for the quantized layouts are still in the depth-first order of the build
+	const bool siblingPairs = settings.nodeLayout == NodeLayout::Binary;
+	for (auto nodeIndex = static_cast<uint32_t>(nodes.size()); nodeIndex-- > 0;)
+	{
+		BVHNode& node = nodes[nodeIndex];
+		if (node.isLeaf())
+		{
+			node.boundingBox = AABB(triangles, vertices,
+			                        Range{node.primitivesOffset, node.primitivesOffset + node.primitiveCount});
+			continue;
+		}
+
+		const uint32_t firstChild = siblingPairs ? node.childrenOffset : nodeIndex + 1;
+		const uint32_t secondChild = siblingPairs ? node.childrenOffset + 1 : node.secondChildOffset;
+		node.boundingBox = nodes[firstChild].boundingBox;
+		node.boundingBox |= nodes[secondChild].boundingBox;
+	}
+}
+
+template <typename T>
+void BVH::refitQuantized(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+                         const std::vector<QuantizedBVHNode<T>>& quantizedNodes)
+{
+	// Quantized bounds are relative to the parent, so the topology is refitted as binary nodes and encoded again
+	nodes.resize(quantizedNodes.size());
+	for (uint32_t nodeIndex = 0; nodeIndex < quantizedNodes.size(); ++nodeIndex)
+	{
+		nodes[nodeIndex].primitivesOffset = quantizedNodes[nodeIndex].primitivesOffset;
+		nodes[nodeIndex].primitiveCount = quantizedNodes[nodeIndex].primitiveCount;
+		nodes[nodeIndex].splitAxis = quantizedNodes[nodeIndex].splitAxis;
+	}
+	refitBinary(triangles, vertices);
+}
+
+template <uint32_t Width>
+void BVH::refitWide(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+                    std::vector<WideBVHNode<Width>>& wideNodes)
+{
+	// collapse emits every wide node after its parent, so a reverse sweep updates the children first
+	for (auto wideNodeIndex = static_cast<uint32_t>(wideNodes.size()); wideNodeIndex-- > 0;)
+	{
+		WideBVHNode<Width>& wideNode = wideNodes[wideNodeIndex];
+		for (uint32_t slot = 0; slot < wideNode.childCount; ++slot)
+		{
+			const uint32_t child = wideNode.children[slot];
+			const uint16_t primitiveCount = wideNode.primitiveCounts[slot];
+			const AABB childBox = primitiveCount != 0
+				? AABB(triangles, vertices, Range{child, child + primitiveCount})
+				: wideNodes[child].getBounds();
+			wideNode.setChild(slot, childBox, child, primitiveCount);
+		}
+	}
+}
+
+float BVH::computeSAHCost(const std::vector<BVHNode>& binaryNodes)
+{
+	if (binaryNodes.empty())
+		return 0.f;
+
+	float cost = 0.f;
+	for (const auto& node : binaryNodes)
+		cost += node.boundingBox.area() * (node.isLeaf() ? static_cast<float>(node.primitiveCount) : 1.f);
+
+	return cost / std::max(binaryNodes[0].boundingBox.area(), std::numeric_limits<float>::min());
+}
+
+template <uint32_t Width>
+float BVH::computeSAHCost(const std::vector<WideBVHNode<Width>>& wideNodes)
+{
+	if (wideNodes.empty())
+		return 0.f;
+
+	float cost = 0.f;
+	for (const auto& wideNode : wideNodes)
+	{
+		cost += wideNode.getBounds().area();
+		for (uint32_t slot = 0; slot < wideNode.childCount; ++slot)
+		{
+			if (wideNode.primitiveCounts[slot] != 0)
+				cost += wideNode.getChildBounds(slot).area() * static_cast<float>(wideNode.primitiveCounts[slot]);
+		}
+	}
+
+	return cost / std::max(wideNodes[0].getBounds().area(), std::numeric_limits<float>::min());
+}
+
+uint32_t BVH::split(std::vector<BuildPrimitive>& primitives, Range range, uint32_t depth, const AABB& boundingBox,
+                    const AABB& centroidBounds, uint8_t& splitAxis, ThreadPool* threadPool) const
+{
+	auto first = primitives.begin() + range.start;
+	auto last = primitives.begin() + range.end;
+
+	Vector3 extent = boundingBox.extent();
+	splitAxis = static_cast<uint8_t>(std::distance(std::begin(extent.data), std::ranges::max_element(extent.data)));
+
+	auto splitEqual = [&]()
+	{
+		uint32_t equalMid = (range.start + range.end) / 2;
+		std::nth_element(first, primitives.begin() + equalMid, last,
+		                 [axis = splitAxis](const BuildPrimitive& a, const BuildPrimitive& b)
+		                 {
+			                 return a.centroid[axis] < b.centroid[axis];
+		                 });
+		return equalMid;
+	};
+
+	uint32_t mid;
+	switch (settings.splitHeuristic)
+	{
+	case SplitHeuristic::Middle:
+		{
+			float midVal = (boundingBox.minPoint[splitAxis] + boundingBox.maxPoint[splitAxis]) * 0.5f;
+			mid = partition(primitives, range, [axis = splitAxis, midVal](const BuildPrimitive& primitive)
+			{
+				return primitive.centroid[axis] < midVal;
+			}, threadPool);
+			if (mid == range.start || mid == range.end)
+				mid = splitEqual();
+		}
+		break;
+	case SplitHeuristic::SAH:
+	case SplitHeuristic::SBVH:
+		{
+			std::optional<SAHSplit> sahSplit = findBinnedSAHSplit(primitives, range, centroidBounds, threadPool);
+			if (!sahSplit.has_value())
+			{
+				mid = splitEqual();
+				break;
+			}
+
+			splitAxis = sahSplit->axis;
+			const float centroidMin = centroidBounds.minPoint[splitAxis];
+			const float binScale = static_cast<float>(settings.sahBinCount) / centroidBounds.extent()[splitAxis];
+			const uint32_t binCount = settings.sahBinCount;
+			const uint32_t splitBin = sahSplit->bin;
+			mid = partition(primitives, range, [=, axis = splitAxis](const BuildPrimitive& primitive)
+			{
+				return getBinIndex(primitive.centroid[axis], centroidMin, binScale, binCount) <= splitBin;
+			}, threadPool);
+			if (mid == range.start || mid == range.end)
+				mid = splitEqual();
+		}
+		break;
+	case SplitHeuristic::Equal:
+	default:
+		mid = splitEqual();
+		break;
+	}
+
+	if (std::max(mid - range.start, range.end - mid) > getSubtreeCapacity(depth + 1))
+		mid = splitEqual();
+
+	return mid;
+}
+
+uint64_t BVH::getSubtreeCapacity(uint32_t depth) const
+{
+	return static_cast<uint64_t>(maxLeafPrimitiveCount) << (settings.maxDepth - std::min(depth, settings.maxDepth));
+}
+
+std::optional<BVH::SAHSplit> BVH::findBinnedSAHSplit(const std::vector<BuildPrimitive>& primitives, Range range,
+                                                     const AABB& centroidBounds, ThreadPool* threadPool) const
+{
+	const uint32_t binCount = settings.sahBinCount;
+	const Vector3 centroidMin = centroidBounds.minPoint;
+	const Vector3 centroidExtent = centroidBounds.extent();
+
+	// Degenerate axes (all centroids project onto the same point) get a zero scale and collapse into bin 0
+	Vector3 binScale;
+	for (uint8_t axis = 0; axis < 3; ++axis)
+		binScale[axis] = centroidExtent[axis] > 0.f ? static_cast<float>(binCount) / centroidExtent[axis] : 0.f;
+
+	// Only the bins in use get initialized, this runs for every interior node
+	auto clearBins = [binCount](SAHBins& bins)
+	{
+		const AABB empty;
+		for (auto& axisBins : bins)
+		{
+			for (uint32_t binIndex = 0; binIndex < binCount; ++binIndex)
+				axisBins[binIndex] = {empty.minPoint, empty.maxPoint, 0};
+		}
+	};
+
+	// Bin all three axes in a single pass over the primitives, large ranges are binned per chunk and merged
+	const uint32_t chunkCount = getChunkCount(range, threadPool, parallelChunkMinPrimitiveCount);
+	std::vector<SAHBins> chunkBins(chunkCount);
+	forEachChunk(range, chunkCount, threadPool, [&](uint32_t chunkIndex, Range chunk)
+	{
+		SAHBins& bins = chunkBins[chunkIndex];
+		clearBins(bins);
+		for (uint32_t primitiveIndex = chunk.start; primitiveIndex < chunk.end; ++primitiveIndex)
+		{
+			const BuildPrimitive& primitive = primitives[primitiveIndex];
+			for (uint8_t axis = 0; axis < 3; ++axis)
+			{
+				SAHBin& bin = bins[axis][getBinIndex(primitive.centroid[axis], centroidMin[axis], binScale[axis],
+				                                     binCount)];
+				bin.minPoint = min(bin.minPoint, primitive.boundingBox.minPoint);
+				bin.maxPoint = max(bin.maxPoint, primitive.boundingBox.maxPoint);
+				bin.count++;
+			}
+		}
+	});
+
+	SAHBins& bins = chunkBins[0];
+	for (uint32_t chunkIndex = 1; chunkIndex < chunkCount; ++chunkIndex)
+	{
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			for (uint32_t binIndex = 0; binIndex < binCount; ++binIndex)
+			{
+				SAHBin& bin = bins[axis][binIndex];
+				const SAHBin& chunkBin = chunkBins[chunkIndex][axis][binIndex];
+				bin.minPoint = min(bin.minPoint, chunkBin.minPoint);
+				bin.maxPoint = max(bin.maxPoint, chunkBin.maxPoint);
+				bin.count += chunkBin.count;
+			}
+		}
+	}
+
+	std::optional<SAHSplit> bestSplit;
+	for (uint8_t axis = 0; axis < 3; ++axis)
+	{
+		if (binScale[axis] == 0.f)
+			continue;
+
+		const auto& axisBins = bins[axis];
+
+		// Sweep from the right to get the cost of everything above each split plane
+		std::array<float, maxSAHBinCount> rightCosts;
+		AABB rightBox;
+		uint32_t rightCount = 0;
+		for (uint32_t binIndex = binCount - 1; binIndex > 0; --binIndex)
+		{
+			rightBox |= axisBins[binIndex].boundingBox();
+			rightCount += axisBins[binIndex].count;
+			rightCosts[binIndex - 1] = rightCount > 0 ? static_cast<float>(rightCount) * rightBox.area() : 0.f;
+		}
+
+		// Sweep from the left and combine with the suffix costs, split i puts bins [0, i] on the left
+		AABB leftBox;
+		uint32_t leftCount = 0;
+		for (uint32_t binIndex = 0; binIndex < binCount - 1; ++binIndex)
+		{
+			leftBox |= axisBins[binIndex].boundingBox();
+			leftCount += axisBins[binIndex].count;
+			if (leftCount == 0 || leftCount == range.count())
+				continue;
+
+			float cost = static_cast<float>(leftCount) * leftBox.area() + rightCosts[binIndex];
+			if (!bestSplit.has_value() || cost < bestSplit->cost)
+				bestSplit = SAHSplit{axis, binIndex, cost};
+		}
+	}
+
+	return bestSplit;
+}
+
+std::optional<BVH::SpatialSplit> BVH::findSpatialSplit(const std::vector<Triangle>& triangles,
+                                                       const VertexBuffer& vertices,
+                                                       const std::vector<BuildPrimitive>& references,
+                                                       const AABB& boundingBox, uint32_t referenceBudget) const
+{
+	const uint32_t binCount = settings.sahBinCount;
+	const auto referenceCount = static_cast<uint32_t>(references.size());
+	const Vector3 extent = boundingBox.extent();
+
+	std::optional<SpatialSplit> bestSplit;
+	for (uint8_t axis = 0; axis < 3; ++axis)
+	{
+		if (extent[axis] <= 0.f)
+			continue;
+
+		// Spatial bins split the node bounds evenly, references are clipped to every bin they span
+		const float axisMin = boundingBox.minPoint[axis];
+		const float binWidth = extent[axis] / static_cast<float>(binCount);
+		const float binScale = static_cast<float>(binCount) / extent[axis];
+
+		std::array<SpatialBin, maxSAHBinCount> bins;
+		for (uint32_t binIndex = 0; binIndex < binCount; ++binIndex)
+			bins[binIndex] = {AABB(), 0, 0};
+
+		for (const BuildPrimitive& reference : references)
+		{
+			const uint32_t firstBin = getBinIndex(reference.boundingBox.minPoint[axis], axisMin, binScale, binCount);
+			const uint32_t lastBin = getBinIndex(reference.boundingBox.maxPoint[axis], axisMin, binScale, binCount);
+			if (firstBin == lastBin)
+			{
+				bins[firstBin].boundingBox |= reference.boundingBox;
+			}
+			else
+			{
+				const Triangle& triangle = triangles[reference.triangleIndex];
+				for (uint32_t binIndex = firstBin; binIndex <= lastBin; ++binIndex)
+				{
+					const float binMin = axisMin + binWidth * static_cast<float>(binIndex);
+					const float binMax = binIndex + 1 == binCount ? boundingBox.maxPoint[axis] : binMin + binWidth;
+					AABB clippedBox = clipTriangle(triangle, vertices, axis, binMin, binMax)
+						.intersection(reference.boundingBox);
+					if (clippedBox.isValid())
+						bins[binIndex].boundingBox |= clippedBox;
+				}
+			}
+			bins[firstBin].entryCount++;
+			bins[lastBin].exitCount++;
+		}
+
+		// Sweep from the right, a reference is on the right of plane i unless it exits at or before bin i
+		std::array<float, maxSAHBinCount> rightAreas;
+		std::array<uint32_t, maxSAHBinCount> rightCounts;
+		AABB rightBox;
+		uint32_t rightCount = 0;
+		for (uint32_t binIndex = binCount - 1; binIndex > 0; --binIndex)
+		{
+			rightBox |= bins[binIndex].boundingBox;
+			rightCount += bins[binIndex].exitCount;
+			rightAreas[binIndex - 1] = rightBox.area();
+			rightCounts[binIndex - 1] = rightCount;
+		}
+
+		AABB leftBox;
+		uint32_t leftCount = 0;
+		for (uint32_t binIndex = 0; binIndex < binCount - 1; ++binIndex)
+		{
+			leftBox |= bins[binIndex].boundingBox;
+			leftCount += bins[binIndex].entryCount;
+			if (leftCount == 0 || rightCounts[binIndex] == 0)
+				continue;
+
+			// References straddling the plane end up on both sides
+			if (leftCount + rightCounts[binIndex] - referenceCount > referenceBudget)
+				continue;
+
+			const float cost = static_cast<float>(leftCount) * leftBox.area() +
+				static_cast<float>(rightCounts[binIndex]) * rightAreas[binIndex];
+			if (!bestSplit.has_value() || cost < bestSplit->cost)
+				bestSplit = SpatialSplit{axis, axisMin + binWidth * static_cast<float>(binIndex + 1), cost};
+		}
+	}
+
+	return bestSplit;
+}
+
+void BVH::splitSpatial(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+                       const std::vector<BuildPrimitive>& references, const SpatialSplit& spatialSplit,
+                       std::vector<BuildPrimitive>& leftReferences, std::vector<BuildPrimitive>& rightReferences)
+{
+	const uint8_t axis = spatialSplit.axis;
+	const float position = spatialSplit.position;
+	for (const BuildPrimitive& reference : references)
+	{
+		if (reference.boundingBox.maxPoint[axis] <= position)
+		{
+			leftReferences.push_back(reference);
+		}
+		else if (reference.boundingBox.minPoint[axis] >= position)
+		{
+			rightReferences.push_back(reference);
+		}
+		else
+		{
+			// Straddling reference, each side gets the part of the triangle on its side of the plane
+			const Triangle& triangle = triangles[reference.triangleIndex];
+			AABB leftBox = clipTriangle(triangle, vertices, axis, std::numeric_limits<float>::lowest(), position)
+				.intersection(reference.boundingBox);
+			AABB rightBox = clipTriangle(triangle, vertices, axis, position, std::numeric_limits<float>::max())
+				.intersection(reference.boundingBox);
+
+			if (leftBox.isValid())
+				leftReferences.push_back({leftBox, leftBox.center(), reference.triangleIndex});
+			if (rightBox.isValid())
+				rightReferences.push_back({rightBox, rightBox.center(), reference.triangleIndex});
+		}
+	}
+}
+
+AABB BVH::clipTriangle(const Triangle& triangle, const VertexBuffer& vertices, uint8_t axis, float minPosition,
+                       float maxPosition)
+{
+	const Vector3 corners[3] = {triangle.getPosition(vertices, 0), triangle.getPosition(vertices, 1),
+	                            triangle.getPosition(vertices, 2)};
+
+	// Bounds of the vertices inside the slab and of the points where the edges cross its planes
+	AABB clippedBox;
+	for (uint32_t vertexIndex = 0; vertexIndex < 3; ++vertexIndex)
+	{
+		const Vector3& a = corners[vertexIndex];
+		const Vector3& b = corners[(vertexIndex + 1) % 3];
+		if (a[axis] >= minPosition && a[axis] <= maxPosition)
+			clippedBox |= AABB(a, a);
+
+		for (float plane : {minPosition, maxPosition})
+		{
+			if ((a[axis] < plane && b[axis] > plane) || (a[axis] > plane && b[axis] < plane))
+			{
+				Vector3 crossing = a + (b - a) * ((plane - a[axis]) / (b[axis] - a[axis]));
+				crossing[axis] = plane;
+				clippedBox |= AABB(crossing, crossing);
+			}
+		}
+	}
+	return clippedBox;
+}
+
+void BVH::computeBounds(const std::vector<BuildPrimitive>& primitives, Range range, AABB& boundingBox,
+                        AABB& centroidBounds, ThreadPool* threadPool)
+{
+	const uint32_t chunkCount = getChunkCount(range, threadPool, parallelChunkMinPrimitiveCount);
+	std::vector<std::pair<AABB, AABB>> chunkBounds(chunkCount);
+	forEachChunk(range, chunkCount, threadPool, [&](uint32_t chunkIndex, Range chunk)
+	{
+		auto& [chunkBoundingBox, chunkCentroidBounds] = chunkBounds[chunkIndex];
+		for (uint32_t primitiveIndex = chunk.start; primitiveIndex < chunk.end; ++primitiveIndex)
+		{
+			const BuildPrimitive& primitive = primitives[primitiveIndex];
+			chunkBoundingBox |= primitive.boundingBox;
+			chunkCentroidBounds |= AABB(primitive.centroid, primitive.centroid);
+		}
+	});
+
+	for (const auto& [chunkBoundingBox, chunkCentroidBounds] : chunkBounds)
+	{
+		boundingBox |= chunkBoundingBox;
+		centroidBounds |= chunkCentroidBounds;
+	}
+}
+
+template <typename Predicate>
+uint32_t BVH::partition(std::vector<BuildPrimitive>& primitives, Range range, Predicate predicate,
+                        ThreadPool* threadPool)
+{
+	const uint32_t chunkCount = getChunkCount(range, threadPool, parallelChunkMinPrimitiveCount);
+	if (chunkCount == 1)
+	{
+		auto midIt = std::partition(primitives.begin() + range.start, primitives.begin() + range.end, predicate);
+		return static_cast<uint32_t>(std::distance(primitives.begin(), midIt));
+	}
+
+	// Count the primitives going left in every chunk, so that each chunk knows where to scatter its primitives
+	std::vector<uint32_t> leftCounts(chunkCount);
+	forEachChunk(range, chunkCount, threadPool, [&](uint32_t chunkIndex, Range chunk)
+	{
+		leftCounts[chunkIndex] = static_cast<uint32_t>(std::count_if(
+			primitives.begin() + chunk.start, primitives.begin() + chunk.end, predicate));
+	});
+
+	const uint32_t leftCount = std::accumulate(leftCounts.begin(), leftCounts.end(), 0u);
+	std::vector<uint32_t> leftOffsets(chunkCount);
+	std::vector<uint32_t> rightOffsets(chunkCount);
+	uint32_t leftOffset = 0;
+	uint32_t rightOffset = leftCount;
+	for (uint32_t chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+	{
+		leftOffsets[chunkIndex] = leftOffset;
+		rightOffsets[chunkIndex] = rightOffset;
+		leftOffset += leftCounts[chunkIndex];
+		rightOffset += getChunk(range, chunkCount, chunkIndex).count() - leftCounts[chunkIndex];
+	}
+
+	std::vector<BuildPrimitive> scratch(range.count());
+	forEachChunk(range, chunkCount, threadPool, [&](uint32_t chunkIndex, Range chunk)
+	{
+		uint32_t leftIndex = leftOffsets[chunkIndex];
+		uint32_t rightIndex = rightOffsets[chunkIndex];
+		for (uint32_t primitiveIndex = chunk.start; primitiveIndex < chunk.end; ++primitiveIndex)
+		{
+			const BuildPrimitive& primitive = primitives[primitiveIndex];
+			scratch[predicate(primitive) ? leftIndex++ : rightIndex++] = primitive;
+		}
+	});
+
+	forEachChunk(range, chunkCount, threadPool, [&](uint32_t, Range chunk)
+	{
+		std::copy(scratch.begin() + (chunk.start - range.start), scratch.begin() + (chunk.end - range.start),
+		          primitives.begin() + chunk.start);
+	});
+
+	return range.start + leftCount;
+}
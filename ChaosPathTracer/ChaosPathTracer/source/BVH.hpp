@@ -1,20 +1,31 @@
 #pragma once
-#include <functional>
+#include <array>
+#include <bit>
+#include <limits>
 #include <mutex>
+#include <optional>
 #include <stack>
 #include <vector>
 
 #include "AABB.hpp"
 #include "Material.hpp"
+#include "QuantizedBVH.hpp"
+#include "RayPacket.hpp"
+#include "TrianglePack.hpp"
+#include "WideBVH.hpp"
 
-struct BVHNode
+class ThreadPool;
+
+// 32 bytes, aligned so that a node never straddles a cache line and siblings often share one
+struct alignas(32) BVHNode
 {
 	AABB boundingBox;
 
 	union
 	{
 		uint32_t primitivesOffset; // leaf;
-		uint32_t secondChildOffset; // interior
+		uint32_t secondChildOffset; // interior while building, the first child directly follows its parent
+		uint32_t childrenOffset; // interior of the binary layout, both children are stored next to each other
 	};
 
 	uint16_t primitiveCount; // 0 -> interior node
@@ -26,77 +37,449 @@ struct BVHNode
 	}
 };
 
+static_assert(sizeof(BVHNode) == 32);
+
 class BVH
 {
+	friend class BVHCache;
+
 public:
 	enum class SplitHeuristic
 	{
 		Equal,
 		Middle,
-		SAH
+		SAH,
+		SBVH, // SAH with spatial splits that duplicate references to triangles straddling the split plane
+		LBVH // linear build over Morton codes of the centroids, for scenes where the build time dominates
 	};
 
-	BVH() = default;
+	// Binary nodes, binary nodes with bounds quantized to 8/16 bits relative to the parent,
+	// or the binary tree collapsed into 4/8-wide nodes tested with SSE/AVX
+	enum class NodeLayout
+	{
+		Binary,
+		Quantized8,
+		Quantized16,
+		Wide4,
+		Wide8
+	};
 
-	BVH(std::vector<Triangle>& triangles)
+	// Order of the binary nodes in memory. Depth-first follows the recursion of the build, van Emde Boas
+	// recursively clusters subtrees of half the height so that every level of a deep traversal stays in a few
+	// cache lines and pages, and access frequency packs the most often entered nodes at the front
+	enum class NodeOrder
 	{
-		Range range{0, static_cast<uint32_t>(triangles.size())};
-		build(triangles, range, 0);
-	}
+		DepthFirst,
+		VanEmdeBoas,
+		AccessFrequency
+	};
+
+	// Which child of a binary node a closest-hit ray enters first. Split axis takes the child on the near side
+	// of the split plane by the sign of the ray direction, distance tests both children and enters the one the
+	// ray reaches first, skipping the other later if a hit closer than its entry distance has been found
+	enum class TraversalOrder
+	{
+		SplitAxis,
+		Distance
+	};
+
+	// Nodes entered and triangles tested by traversals, to compare the traversal orders
+	struct TraversalStats
+	{
+		uint64_t rayCount = 0;
+		uint64_t nodeCount = 0;
+		uint64_t leafCount = 0;
+		uint64_t triangleCount = 0;
+	};
+
+	struct BuildSettings
+	{
+		SplitHeuristic splitHeuristic = SplitHeuristic::SAH;
+		uint32_t sahBinCount = 16;
+		uint32_t maxDepth = 30;
+		uint32_t maxTriangleCountPerLeaf = 4;
+		bool parallelBuild = true;
+		NodeLayout nodeLayout = NodeLayout::Binary;
+		NodeOrder nodeOrder = NodeOrder::DepthFirst;
+		// Access frequency: samples per pixel of the profiling render the order is trained on, the surface
+		// areas estimate the frequencies when 0
+		uint32_t nodeOrderProfileSampleCount = 0;
+		// SBVH: spatial splits are tried when the children of the object split overlap by more than alpha times
+		// the root area, and may duplicate references up to budget times the triangle count
+		float spatialSplitAlpha = 1e-5f;
+		float spatialSplitBudget = 0.3f;
+		// LBVH: restructure small treelets of the Morton tree for a lower SAH cost
+		bool treeletOptimization = false;
+		// Relative SAH cost increase over the last build after which refit asks for a rebuild
+		float refitRebuildThreshold = 0.5f;
+		// Built BVHs are stored next to the scene file and loaded from there while the geometry is unchanged
+		bool useCache = true;
+		// Does not change the tree, only how the binary layout is traversed
+		TraversalOrder traversalOrder = TraversalOrder::SplitAxis;
+		// 4 or 8: leaves start at multiples of the width and are tested as SIMD triangle packs by the closest and
+		// any hit queries, see TrianglePack. 0 tests the triangles one by one
+		uint32_t leafPackWidth = 0;
+
+		bool operator==(const BuildSettings&) const = default;
+	};
+
+	BVH() = default;
+
+	// Reorders the triangles into leaf order, the vertex buffer they index stays as it is. triangleOrder
+	// receives the source index of every reordered triangle, with SBVH a triangle may appear more than once
+	BVH(std::vector<Triangle>& triangles, const VertexBuffer& vertices, const BuildSettings& buildSettings,
+	    std::vector<uint32_t>* triangleOrder = nullptr);
 
-	HitInfo closestHit(const std::vector<Triangle>& triangles, const std::vector<Material>& materials, Ray& ray) const
+	// Builds over arbitrary boxes, e.g. the instances of a top-level BVH. Leaves reference ranges of
+	// primitiveOrder, which maps them back to the indices of primitiveBounds
+	BVH(const std::vector<AABB>& primitiveBounds, const BuildSettings& buildSettings,
+	    std::vector<uint32_t>& primitiveOrder);
+
+	// Updates the node bounds bottom-up after the triangles moved, keeping the topology. The triangles have
+	// to be in the order the constructor left them in. Returns false once the SAH cost degraded past
+	// refitRebuildThreshold, the BVH should then be rebuilt
+	bool refit(const std::vector<Triangle>& triangles, const VertexBuffer& vertices);
+
+	// Moves the binary nodes into the node order of the build settings, called by the build. The access
+	// frequency order ranks the nodes by nodeAccessCounts when given, by their surface area otherwise
+	void reorderNodes(const std::vector<uint32_t>* nodeAccessCounts = nullptr);
+
+	// Leaf policies of traverse, called with the triangle range of every leaf the ray reaches. They test the
+	// intersection records of the triangles in BVH order, see IntersectionTriangle.
+	// Returning true terminates the traversal
+
+	// Records only the distance, triangle and barycentrics of every closer hit. The point, normal and material
+	// are derived once from the final hit, see Scene::completeHit
+	struct ClosestHitPolicy
 	{
-		std::function closestHitFunc = [&triangles, &ray, &materials](HitInfo& hitInfo, uint32_t trianglesStart,
-		                                                              uint32_t trianglesEnd)
+		const std::vector<IntersectionTriangle>& triangles;
+		const std::vector<Material>& materials;
+		Ray& ray;
+
+		bool operator()(HitInfo& hitInfo, uint32_t trianglesStart, uint32_t trianglesEnd) const
 		{
 			for (uint32_t triangleIndex = trianglesStart; triangleIndex < trianglesEnd; ++triangleIndex)
 			{
 				const auto& triangle = triangles[triangleIndex];
 				const auto& material = materials[triangle.materialIndex];
 
-				HitInfo currHitInfo = triangle.intersect(ray, material.cullBackFace());
+				float t;
+				Vector2 barycentrics;
+				if (triangle.intersect(ray, material.cullBackFace(), t, barycentrics) && t < hitInfo.t)
+				{
+					hitInfo.hit = true;
+					hitInfo.t = t;
+					hitInfo.barycentrics = barycentrics;
+					hitInfo.triangleIndex = triangleIndex;
+					ray.maxT = t;
+				}
+			}
+			return false;
+		}
+	};
 
-				if (currHitInfo.hit && currHitInfo.t < hitInfo.t)
+	// Occlusion query, refractive surfaces do not block the ray. Only tests for an intersection and skips
+	// the barycentrics and the hit record, hitInfo.triangleIndex receives the blocking triangle
+	struct AnyHitPolicy
+	{
+		const std::vector<IntersectionTriangle>& triangles;
+		const std::vector<Material>& materials;
+		const Ray& ray;
+
+		bool operator()(HitInfo& hitInfo, uint32_t trianglesStart, uint32_t trianglesEnd) const
+		{
+			for (uint32_t triangleIndex = trianglesStart; triangleIndex < trianglesEnd; ++triangleIndex)
+			{
+				const auto& triangle = triangles[triangleIndex];
+				const auto& material = materials[triangle.materialIndex];
+				if (material.type == Material::Type::REFRACTIVE)
+					continue;
+
+				if (triangle.intersects(ray, material.cullBackFace()))
 				{
-					currHitInfo.triangleIndex = triangleIndex;
-					hitInfo = currHitInfo;
-					ray.maxT = hitInfo.t;
+					hitInfo.hit = true;
+					hitInfo.triangleIndex = triangleIndex;
+					return true;
 				}
 			}
 			return false;
-		};
-		return traverse(ray, closestHitFunc);
-	}
+		}
+	};
 
-	bool anyHit(const std::vector<Triangle>& triangles, const std::vector<Material>& materials, Ray& ray) const
+	// Counts every intersection along the ray
+	struct CountAllPolicy
 	{
-		std::function anyHitFunc = [&triangles, &materials, &ray](HitInfo& hitInfo, uint32_t trianglesStart,
-		                                                          uint32_t trianglesEnd)
+		const std::vector<IntersectionTriangle>& triangles;
+		const std::vector<Material>& materials;
+		const Ray& ray;
+		uint32_t& hitCount;
+
+		bool operator()(HitInfo& hitInfo, uint32_t trianglesStart, uint32_t trianglesEnd) const
 		{
 			for (uint32_t triangleIndex = trianglesStart; triangleIndex < trianglesEnd; ++triangleIndex)
 			{
 				const auto& triangle = triangles[triangleIndex];
 				const auto& material = materials[triangle.materialIndex];
-				HitInfo currHitInfo = triangle.intersect(ray, material.cullBackFace());
+				if (triangle.intersects(ray, material.cullBackFace()))
+				{
+					hitInfo.hit = true;
+					++hitCount;
+				}
+			}
+			return false;
+		}
+	};
+
+	// Closest hit policy over the triangle packs of a BVH built with leafPackWidth, records the same as
+	// ClosestHitPolicy. Every leaf starts a new pack, the lanes past its end are masked out
+	template <uint32_t Width>
+	struct PackedClosestHitPolicy
+	{
+		using FloatW = typename TrianglePack<Width>::FloatW;
+
+		const std::vector<TrianglePack<Width>>& packs;
+		Ray& ray;
+		FloatW origin[3];
+		FloatW direction[3];
+
+		PackedClosestHitPolicy(const std::vector<TrianglePack<Width>>& packs, Ray& ray)
+			: packs(packs), ray(ray)
+		{
+			for (uint8_t axis = 0; axis < 3; ++axis)
+			{
+				origin[axis] = FloatW::broadcast(ray.origin[axis]);
+				direction[axis] = FloatW::broadcast(ray.directionN[axis]);
+			}
+		}
+
+		bool operator()(HitInfo& hitInfo, uint32_t trianglesStart, uint32_t trianglesEnd) const
+		{
+			for (uint32_t packStart = trianglesStart; packStart < trianglesEnd; packStart += Width)
+			{
+				const TrianglePack<Width>& pack = packs[packStart / Width];
+
+				alignas(sizeof(FloatW)) float t[Width];
+				alignas(sizeof(FloatW)) float u[Width];
+				alignas(sizeof(FloatW)) float v[Width];
+				const uint32_t laneMask = TrianglePack<Width>::getLaneMask(trianglesEnd - packStart);
+				const uint32_t hitMask = pack.intersect(origin, direction, ray.maxT, laneMask, t, u, v);
+				if (hitMask == 0)
+					continue;
 
-				if (currHitInfo.hit)
+				// The first of equally distant lanes wins, as in the triangle by triangle test
+				auto lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+				for (uint32_t mask = hitMask & (hitMask - 1); mask != 0; mask &= mask - 1)
 				{
-					const auto& material = materials[triangle.materialIndex];
-					if (material.type != Material::Type::REFRACTIVE)
-					{
-						hitInfo.hit = true;
-						return true;
-					}
+					const auto otherLane = static_cast<uint32_t>(std::countr_zero(mask));
+					if (t[otherLane] < t[lane])
+						lane = otherLane;
+				}
+
+				if (t[lane] < hitInfo.t)
+				{
+					hitInfo.hit = true;
+					hitInfo.t = t[lane];
+					hitInfo.barycentrics = Vector2(u[lane], v[lane]);
+					hitInfo.triangleIndex = packStart + lane;
+					ray.maxT = t[lane];
 				}
 			}
 			return false;
-		};
-		HitInfo hitInfo = traverse(ray, anyHitFunc);
-		return hitInfo.hit;
+		}
+	};
+
+	// Any hit policy over the triangle packs, see PackedClosestHitPolicy
+	template <uint32_t Width>
+	struct PackedAnyHitPolicy
+	{
+		using FloatW = typename TrianglePack<Width>::FloatW;
+
+		const std::vector<TrianglePack<Width>>& packs;
+		const Ray& ray;
+		FloatW origin[3];
+		FloatW direction[3];
+
+		PackedAnyHitPolicy(const std::vector<TrianglePack<Width>>& packs, const Ray& ray)
+			: packs(packs), ray(ray)
+		{
+			for (uint8_t axis = 0; axis < 3; ++axis)
+			{
+				origin[axis] = FloatW::broadcast(ray.origin[axis]);
+				direction[axis] = FloatW::broadcast(ray.directionN[axis]);
+			}
+		}
+
+		bool operator()(HitInfo& hitInfo, uint32_t trianglesStart, uint32_t trianglesEnd) const
+		{
+			for (uint32_t packStart = trianglesStart; packStart < trianglesEnd; packStart += Width)
+			{
+				const TrianglePack<Width>& pack = packs[packStart / Width];
+				const uint32_t laneMask =
+					TrianglePack<Width>::getLaneMask(trianglesEnd - packStart) & pack.occluderMask;
+				if (laneMask == 0)
+					continue;
+
+				alignas(sizeof(FloatW)) float t[Width];
+				alignas(sizeof(FloatW)) float u[Width];
+				alignas(sizeof(FloatW)) float v[Width];
+				const uint32_t hitMask = pack.intersect(origin, direction, ray.maxT, laneMask, t, u, v);
+				if (hitMask != 0)
+				{
+					hitInfo.hit = true;
+					hitInfo.triangleIndex = packStart + static_cast<uint32_t>(std::countr_zero(hitMask));
+					return true;
+				}
+			}
+			return false;
+		}
+	};
+
+	// Distance, triangle and barycentrics of the closest hit, see ClosestHitPolicy
+	HitInfo closestHit(const IntersectionBuffer& intersections, const std::vector<Material>& materials,
+	                   Ray& ray) const
+	{
+		switch (settings.leafPackWidth)
+		{
+		case 4:
+			return traverse(ray, PackedClosestHitPolicy<4>(intersections.packs4, ray));
+		case 8:
+			return traverse(ray, PackedClosestHitPolicy<8>(intersections.packs8, ray));
+		default:
+			return traverse(ray, ClosestHitPolicy{intersections.triangles, materials, ray});
+		}
+	}
+
+	bool anyHit(const IntersectionBuffer& intersections, const std::vector<Material>& materials, Ray& ray) const
+	{
+		return occlusionHit(intersections, materials, ray).hit;
+	}
+
+	// Any hit with the blocking triangle in triangleIndex and no other hit record. The binary layout uses a
+	// traversal of its own that aims to find some occluder as early as possible, see traverseOcclusion
+	HitInfo occlusionHit(const IntersectionBuffer& intersections, const std::vector<Material>& materials,
+	                     const Ray& ray) const
+	{
+		switch (settings.leafPackWidth)
+		{
+		case 4:
+			return traverseAnyHit(ray, PackedAnyHitPolicy<4>(intersections.packs4, ray));
+		case 8:
+			return traverseAnyHit(ray, PackedAnyHitPolicy<8>(intersections.packs8, ray));
+		default:
+			return traverseAnyHit(ray, AnyHitPolicy{intersections.triangles, materials, ray});
+		}
+	}
+
+	// Closest hits of a packet of coherent rays, hitInfos receives the hit of every active lane. The binary
+	// layout tests its nodes for all lanes at once, and finishes a subtree ray by ray once the lanes that
+	// reach it are too few to fill the packet. The other layouts trace every lane on its own
+	template <uint32_t Width>
+	void closestHit(const IntersectionBuffer& intersections, const std::vector<Material>& materials,
+	                RayPacket<Width>& packet, HitInfo* hitInfos) const
+	{
+		if (settings.nodeLayout == NodeLayout::Binary)
+		{
+			traversePacket(intersections.triangles, materials, packet, hitInfos);
+			return;
+		}
+
+		for (uint32_t mask = packet.activeMask; mask != 0; mask &= mask - 1)
+		{
+			const auto lane = static_cast<uint32_t>(std::countr_zero(mask));
+			Ray ray = packet.getRay(lane);
+			hitInfos[lane] = closestHit(intersections, materials, ray);
+			packet.maxT[lane] = ray.maxT;
+		}
+	}
+
+	uint32_t countHits(const IntersectionBuffer& intersections, const std::vector<Material>& materials,
+	                   const Ray& ray) const
+	{
+		uint32_t hitCount = 0;
+		traverse(ray, CountAllPolicy{intersections.triangles, materials, ray, hitCount});
+		return hitCount;
+	}
+
+	// Traverses the active node layout. The leaf policy is a template parameter, so that it gets inlined
+	// into the traversal loop of every layout
+	template <typename LeafPolicy>
+	HitInfo traverse(const Ray& ray, const LeafPolicy& leafPolicy) const
+	{
+		switch (settings.nodeLayout)
+		{
+		case NodeLayout::Quantized8:
+			return traverseQuantized(quantized8Nodes, ray, leafPolicy);
+		case NodeLayout::Quantized16:
+			return traverseQuantized(quantized16Nodes, ray, leafPolicy);
+		case NodeLayout::Wide4:
+			return traverseWide(wide4Nodes, ray, leafPolicy);
+		case NodeLayout::Wide8:
+			return traverseWide(wide8Nodes, ray, leafPolicy);
+		case NodeLayout::Binary:
+		default:
+			return traverseBinary(ray, leafPolicy, IgnoreNodeAccess{});
+		}
+	}
+
+	// Traverses like above and counts how often the ray entered every binary node, for the profiling render
+	// of the access frequency order. The other layouts count nothing
+	template <typename LeafPolicy>
+	HitInfo traverse(const Ray& ray, const LeafPolicy& leafPolicy, std::vector<uint32_t>& nodeAccessCounts) const
+	{
+		if (settings.nodeLayout != NodeLayout::Binary)
+			return traverse(ray, leafPolicy);
+
+		nodeAccessCounts.resize(nodes.size());
+		return traverseBinary(ray, leafPolicy, [&](uint32_t nodeIndex)
+		{
+			++nodeAccessCounts[nodeIndex];
+		});
+	}
+
+	// Traverses like above and adds the nodes the ray entered to stats. Only the binary layout counts
+	template <typename LeafPolicy>
+	HitInfo traverse(const Ray& ray, const LeafPolicy& leafPolicy, TraversalStats& stats) const
+	{
+		++stats.rayCount;
+		if (settings.nodeLayout != NodeLayout::Binary)
+			return traverse(ray, leafPolicy);
+
+		return traverseBinary(ray, leafPolicy, [&](uint32_t nodeIndex)
+		{
+			++stats.nodeCount;
+			if (nodes[nodeIndex].isLeaf())
+			{
+				++stats.leafCount;
+				stats.triangleCount += nodes[nodeIndex].primitiveCount;
+			}
+		});
+	}
+
+	const BuildSettings& getSettings() const
+	{
+		return settings;
 	}
 
-	HitInfo traverse(const Ray& ray, const std::function<bool(HitInfo&, uint32_t, uint32_t)>& hitFunction) const
+	void setTraversalOrder(TraversalOrder traversalOrder)
 	{
+		settings.traversalOrder = traversalOrder;
+	}
+
+private:
+	struct IgnoreNodeAccess
+	{
+		void operator()(uint32_t) const
+		{
+		}
+	};
+
+	template <typename LeafPolicy, typename NodeAccess>
+	HitInfo traverseBinary(const Ray& ray, const LeafPolicy& leafPolicy, const NodeAccess& nodeAccess,
+	                       uint32_t rootIndex = 0) const
+	{
+		if (settings.traversalOrder == TraversalOrder::Distance)
+			return traverseBinaryByDistance(ray, leafPolicy, nodeAccess, rootIndex);
+
 		HitInfo hitInfo;
 		if (nodes.empty())
 			return hitInfo;
@@ -104,12 +487,11 @@ public:
 		const bool dirIsNegative[3] = {ray.directionN.x < 0.f, ray.directionN.y < 0.f, ray.directionN.z < 0.f};
 
 		// Fixed-size stack to avoid dynamic memory allocation
-		constexpr size_t maxStackDepth = 32;
 		uint32_t nodesToTraverse[maxStackDepth];
 		int32_t stackIndex = 0;
 
 		// Insert root node index
-		nodesToTraverse[stackIndex++] = 0;
+		nodesToTraverse[stackIndex++] = rootIndex;
 
 		// Traverse the tree
 		while (stackIndex > 0)
@@ -118,21 +500,23 @@ public:
 			const BVHNode& node = nodes[nodeIndex];
 			if (node.boundingBox.intersect(ray))
 			{
+				nodeAccess(nodeIndex);
 				if (node.primitiveCount > 0)
 				{
 					uint32_t trianglesOffset = node.primitivesOffset;
 					uint32_t trianglesCount = node.primitiveCount;
-					if (hitFunction(hitInfo, trianglesOffset, trianglesOffset + trianglesCount))
+					if (leafPolicy(hitInfo, trianglesOffset, trianglesOffset + trianglesCount))
 						return hitInfo;
 				}
 				else
 				{
-					uint32_t firstChild = nodeIndex + 1;
-					uint32_t secondChild = node.secondChildOffset;
+					// Near child on top, the far one is popped after it
+					uint32_t nearChild = node.childrenOffset;
+					uint32_t farChild = node.childrenOffset + 1;
 					if (dirIsNegative[node.splitAxis])
-						std::swap(firstChild, secondChild);
-					nodesToTraverse[stackIndex++] = firstChild;
-					nodesToTraverse[stackIndex++] = secondChild;
+						std::swap(nearChild, farChild);
+					nodesToTraverse[stackIndex++] = farChild;
+					nodesToTraverse[stackIndex++] = nearChild;
 				}
 			}
 		}
@@ -140,120 +524,560 @@ public:
 		return hitInfo;
 	}
 
-private:
-	void build(std::vector<Triangle>& triangles, Range range, uint32_t depth)
+	// Both children are tested at their parent, the nearer hit one is entered right away and the farther one
+	// is pushed with its entry distance. A popped node is skipped once the leaf policy shortened ray.maxT below
+	// that distance, since it cannot hold a closer hit
+	template <typename LeafPolicy, typename NodeAccess>
+	HitInfo traverseBinaryByDistance(const Ray& ray, const LeafPolicy& leafPolicy, const NodeAccess& nodeAccess,
+	                                 uint32_t rootIndex) const
 	{
-		AABB boundingBox{triangles, range};
-		if (depth >= maxDepth || range.count() <= maxTriangleCountPerLeaf)
+		HitInfo hitInfo;
+		float rootEntryDistance;
+		if (nodes.empty() || !nodes[rootIndex].boundingBox.intersect(ray, rootEntryDistance))
+			return hitInfo;
+
+		struct StackEntry
 		{
-			// Create leaf node
-			BVHNode leafNode{
-				.boundingBox = boundingBox,
-				.primitivesOffset = range.start,
-				.primitiveCount = static_cast<uint16_t>(range.count())
-			};
-			nodes.emplace_back(leafNode);
-		}
-		else
+			uint32_t nodeIndex;
+			float entryDistance;
+		};
+
+		StackEntry nodesToTraverse[maxStackDepth];
+		int32_t stackIndex = 0;
+
+		uint32_t nodeIndex = rootIndex;
+		while (true)
 		{
-			uint32_t mid = (range.start + range.end) / 2;
-			Vector3 extent = boundingBox.extent();
-			uint8_t splitAxis = static_cast<uint8_t>(std::distance(std::begin(extent.data),
-			                                                       std::ranges::max_element(extent.data)));
+			nodeAccess(nodeIndex);
+			const BVHNode& node = nodes[nodeIndex];
+			if (node.isLeaf())
+			{
+				if (leafPolicy(hitInfo, node.primitivesOffset, node.primitivesOffset + node.primitiveCount))
+					return hitInfo;
+			}
+			else
+			{
+				uint32_t nearChild = node.childrenOffset;
+				uint32_t farChild = node.childrenOffset + 1;
+				float nearEntryDistance;
+				float farEntryDistance;
+				const bool nearHit = nodes[nearChild].boundingBox.intersect(ray, nearEntryDistance);
+				const bool farHit = nodes[farChild].boundingBox.intersect(ray, farEntryDistance);
+				if (nearHit && farHit)
+				{
+					if (farEntryDistance < nearEntryDistance)
+					{
+						std::swap(nearChild, farChild);
+						std::swap(nearEntryDistance, farEntryDistance);
+					}
+					nodesToTraverse[stackIndex++] = {farChild, farEntryDistance};
+					nodeIndex = nearChild;
+					continue;
+				}
+				if (nearHit || farHit)
+				{
+					nodeIndex = nearHit ? nearChild : farChild;
+					continue;
+				}
+			}
 
-			switch (splitHeuristic)
+			// Next pushed node the ray still reaches before its closest hit so far
+			while (stackIndex > 0 && nodesToTraverse[stackIndex - 1].entryDistance >= ray.maxT)
+				--stackIndex;
+			if (stackIndex == 0)
+				return hitInfo;
+			nodeIndex = nodesToTraverse[--stackIndex].nodeIndex;
+		}
+	}
+
+	template <typename LeafPolicy>
+	HitInfo traverseAnyHit(const Ray& ray, const LeafPolicy& leafPolicy) const
+	{
+		if (settings.nodeLayout == NodeLayout::Binary)
+			return traverseOcclusion(ray, leafPolicy);
+
+		return traverse(ray, leafPolicy);
+	}
+
+	// Shadow rays only need some hit, not the closest one. Both children are tested at their parent so that
+	// missed ones never reach the stack, and the child nearer to the ray origin is entered first while the other
+	// waits on the stack. Shadow rays start on a surface, and the geometry around it is the likeliest occluder
+	template <typename LeafPolicy>
+	HitInfo traverseOcclusion(const Ray& ray, const LeafPolicy& leafPolicy) const
+	{
+		HitInfo hitInfo;
+		if (nodes.empty() || !nodes[0].boundingBox.intersect(ray))
+			return hitInfo;
+
+		const bool dirIsNegative[3] = {ray.directionN.x < 0.f, ray.directionN.y < 0.f, ray.directionN.z < 0.f};
+
+		// Fixed-size stack to avoid dynamic memory allocation
+		uint32_t nodesToTraverse[maxStackDepth];
+		int32_t stackIndex = 0;
+
+		uint32_t nodeIndex = 0;
+		while (true)
+		{
+			const BVHNode& node = nodes[nodeIndex];
+			if (node.isLeaf())
+			{
+				if (leafPolicy(hitInfo, node.primitivesOffset, node.primitivesOffset + node.primitiveCount))
+					return hitInfo;
+			}
+			else
 			{
-			case SplitHeuristic::Middle:
+				uint32_t firstChild = node.childrenOffset;
+				uint32_t secondChild = node.childrenOffset + 1;
+				const bool firstHit = nodes[firstChild].boundingBox.intersect(ray);
+				const bool secondHit = nodes[secondChild].boundingBox.intersect(ray);
+				if (firstHit && secondHit)
 				{
-					float midVal = (boundingBox.minPoint[splitAxis] + boundingBox.maxPoint[splitAxis]) * 0.5f;
-					auto midIt = std::partition(triangles.begin() + range.start, triangles.begin() + range.end,
-					                            [splitAxis, midVal](const Triangle& tri)
-					                            {
-						                            return tri.centroid()[splitAxis] < midVal;
-					                            });
-					mid = static_cast<uint32_t>(std::distance(triangles.begin(), midIt));
-					if (midIt != triangles.begin() + range.start && midIt != triangles.begin() + range.end)
-						break;
+					if (dirIsNegative[node.splitAxis])
+						std::swap(firstChild, secondChild);
+					nodesToTraverse[stackIndex++] = secondChild;
+					nodeIndex = firstChild;
+					continue;
 				}
-			case SplitHeuristic::Equal:
+				if (firstHit || secondHit)
 				{
-					mid = (range.start + range.end) / 2;
-					std::nth_element(triangles.begin() + range.start, triangles.begin() + mid,
-					                 triangles.begin() + range.end,
-					                 [splitAxis](const Triangle& triA, const Triangle& triB)
-					                 {
-						                 return triA.centroid()[splitAxis] < triB.centroid()[splitAxis];
-					                 });
+					nodeIndex = firstHit ? firstChild : secondChild;
+					continue;
 				}
-				break;
-			case SplitHeuristic::SAH:
-			default:
+			}
+
+			if (stackIndex == 0)
+				return hitInfo;
+			nodeIndex = nodesToTraverse[--stackIndex];
+		}
+	}
+
+	template <uint32_t Width>
+	void traversePacket(const std::vector<IntersectionTriangle>& triangles, const std::vector<Material>& materials,
+	                    RayPacket<Width>& packet, HitInfo* hitInfos) const
+	{
+		for (uint32_t mask = packet.activeMask; mask != 0; mask &= mask - 1)
+			hitInfos[std::countr_zero(mask)] = HitInfo();
+
+		if (nodes.empty())
+			return;
+
+		// Every node carries the lanes that hit its parent
+		struct StackEntry
+		{
+			uint32_t nodeIndex;
+			uint32_t laneMask;
+		};
+
+		StackEntry nodesToTraverse[maxStackDepth];
+		int32_t stackIndex = 0;
+
+		// Insert root node
+		nodesToTraverse[stackIndex++] = {0, packet.activeMask};
+
+		// Lanes whose closest hit so far was found by a packet leaf test, their hits are recorded at the end.
+		// The ones found ray by ray are recorded already
+		uint32_t packetHitMask = 0;
+		uint32_t packetHitTriangles[Width];
+		alignas(32) float tHits[Width];
+
+		while (stackIndex > 0)
+		{
+			const StackEntry entry = nodesToTraverse[--stackIndex];
+			const BVHNode& node = nodes[entry.nodeIndex];
+			if (!packet.mayIntersect(node.boundingBox))
+				continue;
+
+			const uint32_t laneMask = packet.intersect(node.boundingBox, entry.laneMask);
+			if (laneMask == 0)
+				continue;
+
+			if (static_cast<uint32_t>(std::popcount(laneMask)) <= Width / packetDivergenceRatio)
+			{
+				// Diverged, the few remaining lanes finish this subtree on their own
+				for (uint32_t mask = laneMask; mask != 0; mask &= mask - 1)
 				{
-					if (range.count() == 2)
+					const auto lane = static_cast<uint32_t>(std::countr_zero(mask));
+					Ray ray = packet.getRay(lane);
+					const HitInfo hitInfo = traverseBinary(ray, ClosestHitPolicy{triangles, materials, ray},
+					                                       IgnoreNodeAccess{}, entry.nodeIndex);
+					if (hitInfo.hit)
 					{
-						mid = (range.start + range.end) / 2;
-						std::nth_element(triangles.begin() + range.start, triangles.begin() + mid,
-						                 triangles.begin() + range.end,
-						                 [splitAxis](const Triangle& triA, const Triangle& triB)
-						                 {
-							                 return triA.centroid()[splitAxis] < triB.centroid()[splitAxis];
-						                 });
+						hitInfos[lane] = hitInfo;
+						packet.maxT[lane] = hitInfo.t;
+						packetHitMask &= ~(1u << lane);
 					}
-					else
+				}
+				continue;
+			}
+
+			if (node.isLeaf())
+			{
+				for (uint32_t triangleIndex = node.primitivesOffset;
+				     triangleIndex < node.primitivesOffset + node.primitiveCount; ++triangleIndex)
+				{
+					const IntersectionTriangle& triangle = triangles[triangleIndex];
+					const bool backFaceCull = materials[triangle.materialIndex].cullBackFace();
+					for (uint32_t hitMask = packet.intersect(triangle, backFaceCull, laneMask, tHits); hitMask != 0;
+					     hitMask &= hitMask - 1)
 					{
-						float minCost = std::numeric_limits<float>::max();
-						float boundingBoxArea = boundingBox.area();
-						for (uint8_t axis = 0; axis < 3; axis++)
-						{
-							std::sort(triangles.begin() + range.start, triangles.begin() + range.end,
-							          [axis](const Triangle& triA, const Triangle& triB)
-							          {
-								          return triA.centroid()[axis] < triB.centroid()[axis];
-							          });
-							for (uint32_t index = range.start + 1; index < range.end; index++)
-							{
-								AABB left = AABB(triangles, Range(range.start, index));
-								AABB right = AABB(triangles, Range{index, range.end});
-								float cost = ((index - range.start) * left.area() + (range.end - index) * right.area())
-									/ boundingBoxArea;
-								if (cost < minCost)
-								{
-									minCost = cost;
-									splitAxis = axis;
-									mid = index;
-								}
-							}
-						}
-
-						std::sort(triangles.begin() + range.start, triangles.begin() + range.end,
-						          [splitAxis](const Triangle& triA, const Triangle& triB)
-						          {
-							          return triA.centroid()[splitAxis] < triB.centroid()[splitAxis];
-						          });
+						const auto lane = static_cast<uint32_t>(std::countr_zero(hitMask));
+						packet.maxT[lane] = tHits[lane];
+						packetHitTriangles[lane] = triangleIndex;
+						packetHitMask |= 1u << lane;
 					}
 				}
-				break;
+				continue;
 			}
 
-			BVHNode interiorNode{
-				.boundingBox = boundingBox,
-				.primitiveCount = 0,
-				.splitAxis = splitAxis
-			};
+			// Near child on top, by the direction of the first lane
+			const uint32_t firstLane = static_cast<uint32_t>(std::countr_zero(laneMask));
+			uint32_t nearChild = node.childrenOffset;
+			uint32_t farChild = node.childrenOffset + 1;
+			if (packet.direction[node.splitAxis][firstLane] < 0.f)
+				std::swap(nearChild, farChild);
+			nodesToTraverse[stackIndex++] = {farChild, laneMask};
+			nodesToTraverse[stackIndex++] = {nearChild, laneMask};
+		}
 
-			uint32_t interiorNodeIndex = static_cast<uint32_t>(nodes.size());
-			nodes.emplace_back(interiorNode);
+		for (uint32_t mask = packetHitMask; mask != 0; mask &= mask - 1)
+		{
+			const auto lane = static_cast<uint32_t>(std::countr_zero(mask));
+			// The scalar test repeats the SIMD one, it only disagrees on rounding at an edge, where the lane is
+			// traced again on its own
+			Ray ray = packet.getRay(lane);
+			ray.maxT = std::numeric_limits<float>::max();
+			const uint32_t triangleIndex = packetHitTriangles[lane];
+			HitInfo hitInfo;
+			ClosestHitPolicy{triangles, materials, ray}(hitInfo, triangleIndex, triangleIndex + 1);
+			if (!hitInfo.hit)
+				hitInfo = traverseBinary(ray, ClosestHitPolicy{triangles, materials, ray}, IgnoreNodeAccess{});
 
-			build(triangles, Range{range.start, mid}, depth + 1);
+			hitInfos[lane] = hitInfo;
+			packet.maxT[lane] = hitInfo.t;
+		}
+	}
 
-			nodes[interiorNodeIndex].secondChildOffset = static_cast<uint32_t>(nodes.size());
+	template <typename T, typename LeafPolicy>
+	HitInfo traverseQuantized(const std::vector<QuantizedBVHNode<T>>& quantizedNodes, const Ray& ray,
+	                          const LeafPolicy& leafPolicy) const
+	{
+		HitInfo hitInfo;
+		if (quantizedNodes.empty())
+			return hitInfo;
+
+		const bool dirIsNegative[3] = {ray.directionN.x < 0.f, ray.directionN.y < 0.f, ray.directionN.z < 0.f};
+
+		// Nodes are decoded relative to their parent, so the decoded parent box travels with the node index
+		struct StackEntry
+		{
+			uint32_t nodeIndex;
+			AABB parentBox;
+		};
+
+		StackEntry nodesToTraverse[maxStackDepth];
+		int32_t stackIndex = 0;
+
+		// Insert root node
+		nodesToTraverse[stackIndex++] = {0, quantizedRootBox};
+
+		while (stackIndex > 0)
+		{
+			const StackEntry& entry = nodesToTraverse[--stackIndex];
+			const uint32_t nodeIndex = entry.nodeIndex;
+			const QuantizedBVHNode<T>& node = quantizedNodes[nodeIndex];
+			const AABB boundingBox = node.decode(entry.parentBox);
+			if (!boundingBox.intersect(ray))
+				continue;
 
-			build(triangles, Range{mid, range.end}, depth + 1);
+			if (node.isLeaf())
+			{
+				if (leafPolicy(hitInfo, node.primitivesOffset, node.primitivesOffset + node.primitiveCount))
+					return hitInfo;
+			}
+			else
+			{
+				// Near child on top, the far one is popped after it
+				uint32_t nearChild = nodeIndex + 1;
+				uint32_t farChild = node.secondChildOffset;
+				if (dirIsNegative[node.splitAxis])
+					std::swap(nearChild, farChild);
+				nodesToTraverse[stackIndex++] = {farChild, boundingBox};
+				nodesToTraverse[stackIndex++] = {nearChild, boundingBox};
+			}
 		}
+
+		return hitInfo;
 	}
 
+	template <uint32_t Width, typename LeafPolicy>
+	HitInfo traverseWide(const std::vector<WideBVHNode<Width>>& wideNodes, const Ray& ray,
+	                     const LeafPolicy& leafPolicy) const
+	{
+		HitInfo hitInfo;
+		if (wideNodes.empty())
+			return hitInfo;
+
+		const WideRay<Width> wideRay(ray);
+
+		// Children are pushed with their entry distance, so that entries behind the closest hit found
+		// since they were pushed can be skipped. Every level pushes at most Width entries and pops one
+		struct StackEntry
+		{
+			uint32_t child;
+			uint16_t primitiveCount;
+			float tEntry;
+		};
+
+		StackEntry nodesToTraverse[maxStackDepth * (Width - 1) + 1];
+		int32_t stackIndex = 0;
+
+		// Insert root node
+		nodesToTraverse[stackIndex++] = {0, 0, 0.f};
+
+		while (stackIndex > 0)
+		{
+			const StackEntry entry = nodesToTraverse[--stackIndex];
+			if (entry.tEntry > ray.maxT)
+				continue;
+
+			if (entry.primitiveCount > 0)
+			{
+				if (leafPolicy(hitInfo, entry.child, entry.child + entry.primitiveCount))
+					return hitInfo;
+				continue;
+			}
+
+			const WideBVHNode<Width>& node = wideNodes[entry.child];
+			alignas(32) float tEntries[Width];
+			uint32_t hitMask = node.intersect(wideRay, ray.maxT, tEntries);
+
+			// Sort the hit children far to near, so that the nearest one ends up on top of the stack
+			uint32_t hitSlots[Width];
+			uint32_t hitCount = 0;
+			while (hitMask != 0)
+			{
+				const auto slot = static_cast<uint32_t>(std::countr_zero(hitMask));
+				hitMask &= hitMask - 1;
+
+				uint32_t insertIndex = hitCount++;
+				while (insertIndex > 0 && tEntries[hitSlots[insertIndex - 1]] < tEntries[slot])
+				{
+					hitSlots[insertIndex] = hitSlots[insertIndex - 1];
+					--insertIndex;
+				}
+				hitSlots[insertIndex] = slot;
+			}
+
+			for (uint32_t hitIndex = 0; hitIndex < hitCount; ++hitIndex)
+			{
+				const uint32_t slot = hitSlots[hitIndex];
+				nodesToTraverse[stackIndex++] = {node.children[slot], node.primitiveCounts[slot], tEntries[slot]};
+			}
+		}
+
+		return hitInfo;
+	}
+
+	struct BuildPrimitive
+	{
+		AABB boundingBox;
+		Vector3 centroid;
+		uint32_t triangleIndex; // or the box index when not building over triangles
+	};
+
+	struct SAHBin
+	{
+		AABB boundingBox() const { return {minPoint, maxPoint}; }
+
+		Vector3 minPoint;
+		Vector3 maxPoint;
+		uint32_t count;
+	};
+
+	using SAHBins = std::array<std::array<SAHBin, 64>, 3>;
+
+	struct SAHSplit
+	{
+		uint8_t axis;
+		uint32_t bin;
+		float cost;
+	};
+
+	template <typename MortonCode>
+	struct MortonPrimitive
+	{
+		MortonCode code;
+		uint32_t primitiveIndex;
+	};
+
+	// Node of the tree emitted by the linear build, which is restructured by the treelet optimization and
+	// flattened into the depth-first layout at the end
+	struct LinearNode
+	{
+		AABB boundingBox;
+		Range range; // leaf primitives, empty for interior nodes
+		uint32_t children[2];
+		uint32_t height; // 0 for leaves
+		float cost; // SAH cost of the subtree, not normalized by the root area
+		uint8_t splitAxis;
+
+		bool isLeaf() const
+		{
+			return range.count() != 0;
+		}
+	};
+
+	struct SpatialBin
+	{
+		AABB boundingBox;
+		uint32_t entryCount;
+		uint32_t exitCount;
+	};
+
+	struct SpatialSplit
+	{
+		uint8_t axis;
+		float position;
+		float cost;
+	};
+
+	// Interior node created by the serial top of a parallel build. Children are either further top nodes
+	// or, when negative, subtree tasks (~taskIndex) that are built independently
+	struct TopLevelNode
+	{
+		AABB boundingBox;
+		uint8_t splitAxis;
+		int32_t children[2];
+	};
+
+	struct SubtreeTask
+	{
+		Range range;
+		uint32_t depth;
+		std::vector<BVHNode> nodes;
+	};
+
+	void buildHierarchy(std::vector<BuildPrimitive>& primitives, const std::vector<Triangle>* triangles,
+	                    const VertexBuffer* vertices, ThreadPool* threadPool);
+
+	void convertLayout();
+
+	// Moves every leaf to an offset that is a multiple of leafPackWidth, see BuildSettings
+	void alignLeaves(std::vector<BuildPrimitive>& primitives);
+
+	void pairSiblings();
+
+	void emitVanEmdeBoas(uint32_t pairIndex, uint32_t levelCount, std::vector<uint32_t>& pairOrder,
+	                     std::vector<uint32_t>& belowPairs) const;
+
+	void orderByAccessFrequency(const std::vector<uint32_t>* nodeAccessCounts, std::vector<uint32_t>& pairOrder) const;
+
+	void build(std::vector<BuildPrimitive>& primitives, Range range, uint32_t depth,
+	           std::vector<BVHNode>& outNodes) const;
+
+	void buildParallel(std::vector<BuildPrimitive>& primitives, ThreadPool& threadPool);
+
+	void buildSpatial(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+	                  std::vector<BuildPrimitive> references, uint32_t depth, float rootArea, uint32_t referenceBudget,
+	                  std::vector<BVHNode>& outNodes, std::vector<BuildPrimitive>& outPrimitives) const;
+
+	template <typename MortonCode>
+	void buildLinear(std::vector<BuildPrimitive>& primitives, ThreadPool* threadPool);
+
+	template <typename MortonCode>
+	static void radixSort(std::vector<MortonPrimitive<MortonCode>>& mortonPrimitives, ThreadPool* threadPool);
+
+	template <typename MortonCode>
+	uint32_t emitLinear(const std::vector<MortonCode>& mortonCodes, const std::vector<BuildPrimitive>& primitives,
+	                    Range range, uint32_t depth, std::vector<LinearNode>& linearNodes) const;
+
+	void optimizeTreelets(std::vector<LinearNode>& linearNodes, uint32_t rootIndex, ThreadPool* threadPool) const;
+
+	void optimizeTreeletsBelow(std::vector<LinearNode>& linearNodes, uint32_t nodeIndex, uint32_t depth,
+	                           uint32_t stopDepth) const;
+
+	bool optimizeTreelet(std::vector<LinearNode>& linearNodes, uint32_t rootIndex, uint32_t depth) const;
+
+	void flattenLinear(const std::vector<LinearNode>& linearNodes, uint32_t linearNodeIndex,
+	                   const std::vector<BuildPrimitive>& primitives, std::vector<BuildPrimitive>& outPrimitives);
+
+	int32_t buildTopLevel(std::vector<BuildPrimitive>& primitives, Range range, uint32_t depth,
+	                      uint32_t subtreeTaskSize, std::vector<TopLevelNode>& topLevelNodes,
+	                      std::vector<SubtreeTask>& subtreeTasks, ThreadPool& threadPool) const;
+
+	void emitTopLevel(int32_t topLevelIndex, std::vector<TopLevelNode>& topLevelNodes,
+	                  std::vector<SubtreeTask>& subtreeTasks);
+
+	// Falls back to the median when a child would not fit into the levels below depth, see getSubtreeCapacity
+	uint32_t split(std::vector<BuildPrimitive>& primitives, Range range, uint32_t depth, const AABB& boundingBox,
+	               const AABB& centroidBounds, uint8_t& splitAxis, ThreadPool* threadPool) const;
+
+	// Most primitives a subtree rooted at depth can hold with leaves of at most maxLeafPrimitiveCount
+	uint64_t getSubtreeCapacity(uint32_t depth) const;
+
+	std::optional<SAHSplit> findBinnedSAHSplit(const std::vector<BuildPrimitive>& primitives, Range range,
+	                                           const AABB& centroidBounds, ThreadPool* threadPool) const;
+
+	std::optional<SpatialSplit> findSpatialSplit(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+	                                             const std::vector<BuildPrimitive>& references,
+	                                             const AABB& boundingBox, uint32_t referenceBudget) const;
+
+	static void splitSpatial(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+	                         const std::vector<BuildPrimitive>& references, const SpatialSplit& spatialSplit,
+	                         std::vector<BuildPrimitive>& leftReferences, std::vector<BuildPrimitive>& rightReferences);
+
+	static AABB clipTriangle(const Triangle& triangle, const VertexBuffer& vertices, uint8_t axis, float minPosition,
+	                         float maxPosition);
+
+	static void computeBounds(const std::vector<BuildPrimitive>& primitives, Range range, AABB& boundingBox,
+	                          AABB& centroidBounds, ThreadPool* threadPool);
+
+	template <typename T>
+	void quantize(uint32_t nodeIndex, const AABB& parentBox, const Vector3& margin,
+	              std::vector<QuantizedBVHNode<T>>& quantizedNodes) const;
+
+	template <uint32_t Width>
+	void collapse(uint32_t nodeIndex, uint32_t wideNodeIndex, std::vector<WideBVHNode<Width>>& wideNodes) const;
+
+	void refitBinary(const std::vector<Triangle>& triangles, const VertexBuffer& vertices);
+
+	template <typename T>
+	void refitQuantized(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+	                    const std::vector<QuantizedBVHNode<T>>& quantizedNodes);
+
+	template <uint32_t Width>
+	static void refitWide(const std::vector<Triangle>& triangles, const VertexBuffer& vertices,
+	                      std::vector<WideBVHNode<Width>>& wideNodes);
+
+	// Expected cost of a random ray relative to the root area, one unit per node visit and per triangle test
+	static float computeSAHCost(const std::vector<BVHNode>& binaryNodes);
+
+	template <uint32_t Width>
+	static float computeSAHCost(const std::vector<WideBVHNode<Width>>& wideNodes);
+
+	template <typename Predicate>
+	static uint32_t partition(std::vector<BuildPrimitive>& primitives, Range range, Predicate predicate,
+	                          ThreadPool* threadPool);
+
 	std::vector<BVHNode> nodes;
-	static constexpr uint32_t maxDepth = 10;
-	static constexpr uint32_t maxTriangleCountPerLeaf = 4;
-	static constexpr SplitHeuristic splitHeuristic = SplitHeuristic::Middle;
+	std::vector<QuantizedBVHNode<uint8_t>> quantized8Nodes;
+	std::vector<QuantizedBVHNode<uint16_t>> quantized16Nodes;
+	AABB quantizedRootBox;
+	std::vector<WideBVHNode<4>> wide4Nodes;
+	std::vector<WideBVHNode<8>> wide8Nodes;
+	BuildSettings settings;
+	float builtSAHCost = 0.f;
+
+	static constexpr uint32_t maxStackDepth = 32;
+	static constexpr uint32_t maxLeafPrimitiveCount = std::numeric_limits<decltype(BVHNode::primitiveCount)>::max();
+	static constexpr uint32_t maxSAHBinCount = std::tuple_size_v<SAHBins::value_type>;
+	static constexpr uint32_t parallelBuildMinPrimitiveCount = 1 << 16;
+	static constexpr uint32_t subtreeTaskMinPrimitiveCount = 1 << 12;
+	static constexpr uint32_t parallelChunkMinPrimitiveCount = 1 << 14;
+	static constexpr uint32_t linearBuild30BitMaxPrimitiveCount = 1 << 20;
+	static constexpr uint32_t radixDigitBits = 8;
+	static constexpr uint32_t treeletLeafCount = 5;
+	static constexpr uint32_t treeletPassCount = 2;
+	// Packets with at most this fraction of their lanes left in a subtree fall back to single rays
+	static constexpr uint32_t packetDivergenceRatio = 4;
 };
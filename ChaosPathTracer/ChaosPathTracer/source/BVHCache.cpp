@@ -0,0 +1,351 @@
+#include "BVHCache.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <type_traits>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	// Read-only memory mapping of a whole file, empty when the file does not exist
+	class MappedFile final
+	{
+	public:
+		explicit MappedFile(const std::string& fileName)
+		{
+#if defined(_WIN32)
+			HANDLE file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+			                          FILE_ATTRIBUTE_NORMAL, nullptr);
+			if (file == INVALID_HANDLE_VALUE)
+				return;
+
+			LARGE_INTEGER fileSize;
+			if (GetFileSizeEx(file, &fileSize) && fileSize.QuadPart > 0)
+			{
+				HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+				if (mapping)
+				{
+					// The view keeps the mapping alive
+					data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+					if (data)
+						size = static_cast<size_t>(fileSize.QuadPart);
+					CloseHandle(mapping);
+				}
+			}
+			CloseHandle(file);
+#else
+			const int file = open(fileName.c_str(), O_RDONLY);
+			if (file < 0)
+				return;
+
+			struct stat fileStat;
+			if (fstat(file, &fileStat) == 0 && fileStat.st_size > 0)
+			{
+				void* mapped = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+				if (mapped != MAP_FAILED)
+				{
+					data = mapped;
+					size = static_cast<size_t>(fileStat.st_size);
+				}
+			}
+			close(file);
+#endif
+		}
+
+		~MappedFile()
+		{
+			if (!data)
+				return;
+#if defined(_WIN32)
+			UnmapViewOfFile(data);
+#else
+			munmap(data, size);
+#endif
+		}
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		const std::byte* begin() const { return static_cast<const std::byte*>(data); }
+		const std::byte* end() const { return begin() + size; }
+
+	private:
+		void* data = nullptr;
+		size_t size = 0;
+	};
+
+	// Bounds checked sequential reads from the mapping
+	class Reader final
+	{
+	public:
+		Reader(const std::byte* begin, const std::byte* end)
+			: cursor(begin), end(end)
+		{
+		}
+
+		template <typename T>
+		bool read(T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			if (static_cast<size_t>(end - cursor) < sizeof(T))
+				return false;
+
+			std::memcpy(&value, cursor, sizeof(T));
+			cursor += sizeof(T);
+			return true;
+		}
+
+		template <typename T>
+		bool read(std::vector<T>& values, uint32_t count)
+		{
+			static_assert(std::is_trivially_copyable_v<T>);
+			if (static_cast<size_t>(end - cursor) / sizeof(T) < count)
+				return false;
+
+			values.resize(count);
+			std::memcpy(values.data(), cursor, count * sizeof(T));
+			cursor += count * sizeof(T);
+			return true;
+		}
+
+		bool skip(size_t size)
+		{
+			if (static_cast<size_t>(end - cursor) < size)
+				return false;
+
+			cursor += size;
+			return true;
+		}
+
+	private:
+		const std::byte* cursor;
+		const std::byte* end;
+	};
+
+	struct FileHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t entryCount;
+	};
+
+	struct EntryHeader
+	{
+		uint64_t key;
+		uint32_t nodeLayout;
+		uint32_t nodeCount;
+		uint32_t triangleOrderCount;
+		float builtSAHCost;
+		AABB quantizedRootBox;
+	};
+
+	size_t getNodeSize(BVH::NodeLayout nodeLayout)
+	{
+		switch (nodeLayout)
+		{
+		case BVH::NodeLayout::Quantized8:
+			return sizeof(QuantizedBVHNode<uint8_t>);
+		case BVH::NodeLayout::Quantized16:
+			return sizeof(QuantizedBVHNode<uint16_t>);
+		case BVH::NodeLayout::Wide4:
+			return sizeof(WideBVHNode<4>);
+		case BVH::NodeLayout::Wide8:
+			return sizeof(WideBVHNode<8>);
+		case BVH::NodeLayout::Binary:
+		default:
+			return sizeof(BVHNode);
+		}
+	}
+
+	// FNV-1a
+	template <typename T>
+	uint64_t hashValue(uint64_t hash, const T& value)
+	{
+		unsigned char bytes[sizeof(T)];
+		std::memcpy(bytes, &value, sizeof(T));
+		for (unsigned char byte : bytes)
+		{
+			hash ^= byte;
+			hash *= 1099511628211ull;
+		}
+		return hash;
+	}
+
+	uint64_t hashPosition(uint64_t hash, const Vector3& position)
+	{
+		return hashValue(hashValue(hashValue(hash, position.x), position.y), position.z);
+	}
+}
+
+template <typename BVHType, typename Func>
+void BVHCache::visitNodes(BVHType& bvh, Func&& func)
+{
+	switch (bvh.settings.nodeLayout)
+	{
+	case BVH::NodeLayout::Quantized8:
+		func(bvh.quantized8Nodes);
+		break;
+	case BVH::NodeLayout::Quantized16:
+		func(bvh.quantized16Nodes);
+		break;
+	case BVH::NodeLayout::Wide4:
+		func(bvh.wide4Nodes);
+		break;
+	case BVH::NodeLayout::Wide8:
+		func(bvh.wide8Nodes);
+		break;
+	case BVH::NodeLayout::Binary:
+	default:
+		func(bvh.nodes);
+		break;
+	}
+}
+
+BVHCache::BVHCache(std::string fileName, const BVH::BuildSettings& buildSettings, std::vector<Entry> entries)
+	: fileName(std::move(fileName)), buildSettings(buildSettings), entries(std::move(entries))
+{
+	keys.reserve(this->entries.size());
+	for (const auto& entry : this->entries)
+		keys.push_back(computeKey(entry, buildSettings));
+}
+
+bool BVHCache::load() const
+{
+	MappedFile file(fileName);
+	if (!file.begin())
+		return false;
+
+	FileHeader fileHeader;
+	Reader reader(file.begin(), file.end());
+	if (!reader.read(fileHeader) || std::memcmp(fileHeader.magic, magic, sizeof(magic)) != 0 ||
+		fileHeader.version != version || fileHeader.entryCount != entries.size())
+		return false;
+
+	// Validate everything first, so that a stale cache leaves the entries untouched
+	const Reader entriesReader = reader;
+	for (uint32_t entryIndex = 0; entryIndex < entries.size(); ++entryIndex)
+	{
+		EntryHeader entryHeader;
+		if (!reader.read(entryHeader) || entryHeader.key != keys[entryIndex] ||
+			entryHeader.nodeLayout != static_cast<uint32_t>(buildSettings.nodeLayout))
+			return false;
+
+		if (!reader.skip(getNodeSize(buildSettings.nodeLayout) * entryHeader.nodeCount))
+			return false;
+
+		// A corrupt body may still match the key, the order must only reference triangles of the entry
+		const size_t triangleCount = entries[entryIndex].triangles.size();
+		for (uint32_t orderIndex = 0; orderIndex < entryHeader.triangleOrderCount; ++orderIndex)
+		{
+			uint32_t triangleIndex;
+			if (!reader.read(triangleIndex) || triangleIndex >= triangleCount)
+				return false;
+		}
+	}
+
+	reader = entriesReader;
+	for (const auto& entry : entries)
+	{
+		EntryHeader entryHeader;
+		reader.read(entryHeader);
+
+		entry.bvh = BVH();
+		entry.bvh.settings = buildSettings;
+		entry.bvh.builtSAHCost = entryHeader.builtSAHCost;
+		entry.bvh.quantizedRootBox = entryHeader.quantizedRootBox;
+		visitNodes(entry.bvh, [&](auto& nodes)
+		{
+			reader.read(nodes, entryHeader.nodeCount);
+		});
+		reader.read(entry.triangleOrder, entryHeader.triangleOrderCount);
+
+		std::vector<Triangle> orderedTriangles;
+		orderedTriangles.reserve(entry.triangleOrder.size());
+		for (uint32_t triangleIndex : entry.triangleOrder)
+			orderedTriangles.push_back(entry.triangles[triangleIndex]);
+		entry.triangles = std::move(orderedTriangles);
+	}
+	return true;
+}
+
+void BVHCache::save() const
+{
+	std::ofstream ofs(fileName, std::ios::binary | std::ios::trunc);
+
+	FileHeader fileHeader{};
+	std::memcpy(fileHeader.magic, magic, sizeof(magic));
+	fileHeader.version = version;
+	fileHeader.entryCount = static_cast<uint32_t>(entries.size());
+	ofs.write(reinterpret_cast<const char*>(&fileHeader), sizeof(fileHeader));
+
+	for (uint32_t entryIndex = 0; entryIndex < entries.size(); ++entryIndex)
+	{
+		const Entry& entry = entries[entryIndex];
+		visitNodes(entry.bvh, [&](const auto& nodes)
+		{
+			EntryHeader entryHeader{
+				.key = keys[entryIndex],
+				.nodeLayout = static_cast<uint32_t>(buildSettings.nodeLayout),
+				.nodeCount = static_cast<uint32_t>(nodes.size()),
+				.triangleOrderCount = static_cast<uint32_t>(entry.triangleOrder.size()),
+				.builtSAHCost = entry.bvh.builtSAHCost,
+				.quantizedRootBox = entry.bvh.quantizedRootBox
+			};
+			ofs.write(reinterpret_cast<const char*>(&entryHeader), sizeof(entryHeader));
+			ofs.write(reinterpret_cast<const char*>(nodes.data()),
+			          static_cast<std::streamsize>(nodes.size() * sizeof(nodes[0])));
+		});
+		ofs.write(reinterpret_cast<const char*>(entry.triangleOrder.data()),
+		          static_cast<std::streamsize>(entry.triangleOrder.size() * sizeof(uint32_t)));
+	}
+
+	if (!ofs)
+		std::cerr << "Failed to write the BVH cache " << fileName << "\n";
+}
+
+uint64_t BVHCache::computeKey(const Entry& entry, const BVH::BuildSettings& buildSettings)
+{
+	uint64_t hash = 14695981039346656037ull;
+	hash = hashValue(hash, static_cast<uint32_t>(buildSettings.splitHeuristic));
+	hash = hashValue(hash, buildSettings.sahBinCount);
+	hash = hashValue(hash, buildSettings.maxDepth);
+	hash = hashValue(hash, buildSettings.maxTriangleCountPerLeaf);
+	hash = hashValue(hash, buildSettings.parallelBuild);
+	hash = hashValue(hash, static_cast<uint32_t>(buildSettings.nodeLayout));
+	hash = hashValue(hash, buildSettings.spatialSplitAlpha);
+	hash = hashValue(hash, buildSettings.spatialSplitBudget);
+	hash = hashValue(hash, buildSettings.treeletOptimization);
+	hash = hashValue(hash, static_cast<uint32_t>(buildSettings.nodeOrder));
+	hash = hashValue(hash, buildSettings.nodeOrderProfileSampleCount);
+	hash = hashValue(hash, buildSettings.leafPackWidth);
+
+	// A trained node order only holds for the view it was profiled from
+	if (entry.profileView.has_value())
+	{
+		hash = hashValue(hash, entry.profileView->cameraTransform);
+		hash = hashValue(hash, entry.profileView->imageWidth);
+		hash = hashValue(hash, entry.profileView->imageHeight);
+		hash = hashValue(hash, entry.profileView->traceDepth);
+	}
+
+	// Only the positions shape the hierarchy
+	hash = hashValue(hash, static_cast<uint64_t>(entry.triangles.size()));
+	for (const auto& triangle : entry.triangles)
+	{
+		hash = hashPosition(hash, triangle.getPosition(entry.vertices, 0));
+		hash = hashPosition(hash, triangle.getPosition(entry.vertices, 1));
+		hash = hashPosition(hash, triangle.getPosition(entry.vertices, 2));
+	}
+	return hash;
+}
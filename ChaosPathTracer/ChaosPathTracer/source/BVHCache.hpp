@@ -0,0 +1,58 @@
+#pragma once
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "BVH.hpp"
+
+// Versioned binary file with the built BVHs of a scene and their triangle orders, stored next to the scene
+// file. Every BVH is keyed by a hash of its triangles and of the build settings, and of the profiling view of
+// a trained node order, so a changed scene simply misses the cache and is rebuilt
+class BVHCache final
+{
+public:
+	// Camera and image of the profiling render an access frequency node order was trained on
+	struct ProfileView
+	{
+		Matrix4 cameraTransform;
+		uint32_t imageWidth;
+		uint32_t imageHeight;
+		uint32_t traceDepth;
+	};
+
+	// Geometry cached under one BVH, the triangles in parse order until the BVH is built or loaded
+	struct Entry
+	{
+		std::vector<Triangle>& triangles;
+		const VertexBuffer& vertices;
+		std::vector<uint32_t>& triangleOrder;
+		BVH& bvh;
+		std::optional<ProfileView> profileView;
+	};
+
+	// The keys are hashed here, before the build reorders the triangles
+	BVHCache(std::string fileName, const BVH::BuildSettings& buildSettings, std::vector<Entry> entries);
+
+	// Memory maps the cache file and fills the BVHs and triangle orders of all entries, and reorders their
+	// triangles. Returns false and leaves the entries untouched when the file is missing or any key differs
+	bool load() const;
+
+	// Writes the BVHs of all entries once they are built
+	void save() const;
+
+private:
+	// Calls func with the node array of the layout the BVH is built with
+	template <typename BVHType, typename Func>
+	static void visitNodes(BVHType& bvh, Func&& func);
+
+	static uint64_t computeKey(const Entry& entry, const BVH::BuildSettings& buildSettings);
+
+	static constexpr char magic[8] = {'C', 'P', 'T', 'B', 'V', 'H', '\0', '\0'};
+	static constexpr uint32_t version = 2;
+
+	std::string fileName;
+	BVH::BuildSettings buildSettings;
+	std::vector<Entry> entries;
+	std::vector<uint64_t> keys;
+};
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <utility>
+#include <string>
+#include <type_traits>
+
+#include "Sampling.hpp"
+#include "Scene.hpp"
+
+// Measures the single-threaded ray throughput of the BVH queries, once with the leaf policy inlined into
+// the traversal and once called through std::function, the closest-hit work of both traversal orders, and
+// the triangle packs of the leaves against testing their triangles one by one
+class TraversalBenchmark final
+{
+public:
+	TraversalBenchmark(Scene& scene)
+		: scene(scene)
+	{
+	}
+
+	void run()
+	{
+		generateRays();
+
+		std::cout << "Traversal benchmark: " << primaryRays.size() << " primary rays, " << secondaryRays.size()
+			<< " secondary rays\n";
+
+		compare<BVH::ClosestHitPolicy>("closest hit, primary", primaryRays);
+		compare<BVH::ClosestHitPolicy>("closest hit, secondary", secondaryRays);
+		compare<BVH::AnyHitPolicy>("any hit, secondary", secondaryRays);
+		compare<BVH::CountAllPolicy>("count all, primary", primaryRays);
+
+		compareTraversalOrders("closest hit, primary", primaryRays);
+		compareTraversalOrders("closest hit, secondary", secondaryRays);
+
+		if (scene.bvh.getSettings().leafPackWidth == 4)
+			compareLeafPacks(scene.intersections.packs4);
+		else if (scene.bvh.getSettings().leafPackWidth == 8)
+			compareLeafPacks(scene.intersections.packs8);
+	}
+
+private:
+	using LeafFunction = std::function<bool(HitInfo&, uint32_t, uint32_t)>;
+
+	// One jittered primary ray per pixel, and a cosine-distributed bounce ray from every primary hit
+	void generateRays()
+	{
+		const uint32_t imageWidth = scene.settings.imageSettings.width;
+		const uint32_t imageHeight = scene.settings.imageSettings.height;
+
+		Sampling::RandomSampler randomSampler;
+		primaryRays.clear();
+		secondaryRays.clear();
+		for (uint32_t rowIdx = 0; rowIdx < imageHeight; ++rowIdx)
+		{
+			for (uint32_t colIdx = 0; colIdx < imageWidth; ++colIdx)
+			{
+				const float y = static_cast<float>(rowIdx) + randomSampler.next1D();
+				const float x = static_cast<float>(colIdx) + randomSampler.next1D();
+				const Vector2 samplePosition = Camera::toScreenSpace(x, y, imageWidth, imageHeight);
+
+				Ray ray = scene.camera.generateRay(samplePosition.x, samplePosition.y);
+				primaryRays.push_back(ray);
+
+				HitInfo hitInfo = scene.closestHit(ray);
+				if (!hitInfo.hit)
+					continue;
+
+				Vector3 normal = Dot(hitInfo.normal, ray.directionN) > 0.f ? -hitInfo.normal : hitInfo.normal;
+				Vector3 direction = randomInHemisphereCosine(normal, randomSampler.next2D());
+				secondaryRays.emplace_back(OffsetRayOrigin(hitInfo.point, normal), direction);
+			}
+		}
+	}
+
+	template <typename LeafPolicy>
+	void compare(const std::string& name, const std::vector<Ray>& rays) const
+	{
+		uint64_t inlinedChecksum = 0;
+		uint64_t functionChecksum = 0;
+		const double inlinedRate = measure<LeafPolicy>(rays, inlinedChecksum, [](const LeafPolicy& leafPolicy)
+		{
+			return leafPolicy;
+		});
+		const double functionRate = measure<LeafPolicy>(rays, functionChecksum, [](const LeafPolicy& leafPolicy)
+		{
+			return LeafFunction(leafPolicy);
+		});
+
+		std::cout << std::fixed << std::setprecision(2) << "  " << std::left << std::setw(24) << name
+			<< " template " << inlinedRate << " Mrays/s, std::function " << functionRate << " Mrays/s, speedup "
+			<< inlinedRate / functionRate << "x\n";
+
+		if (inlinedChecksum != functionChecksum)
+			std::cerr << "  " << name << ": results of the two paths differ\n";
+	}
+
+	// Rate and nodes entered per ray of every traversal order, the binary layout only
+	void compareTraversalOrders(const std::string& name, const std::vector<Ray>& rays)
+	{
+		if (scene.bvh.getSettings().nodeLayout != BVH::NodeLayout::Binary || rays.empty())
+			return;
+
+		const std::pair<std::string, BVH::TraversalOrder> traversalOrders[] = {
+			{"split axis", BVH::TraversalOrder::SplitAxis},
+			{"distance", BVH::TraversalOrder::Distance}
+		};
+
+		const BVH::TraversalOrder sceneTraversalOrder = scene.bvh.getSettings().traversalOrder;
+		for (const auto& [orderName, traversalOrder] : traversalOrders)
+		{
+			scene.bvh.setTraversalOrder(traversalOrder);
+
+			BVH::TraversalStats stats;
+			for (Ray ray : rays)
+			{
+				const BVH::ClosestHitPolicy leafPolicy{scene.intersections.triangles, scene.materials, ray};
+				scene.bvh.traverse(ray, leafPolicy, stats);
+			}
+
+			uint64_t checksum = 0;
+			const double rate = measure<BVH::ClosestHitPolicy>(rays, checksum,
+			                                                   [](const BVH::ClosestHitPolicy& leafPolicy)
+			                                                   {
+				                                                   return leafPolicy;
+			                                                   });
+
+			const auto perRay = [&](uint64_t count)
+			{
+				return static_cast<double>(count) / static_cast<double>(stats.rayCount);
+			};
+			std::cout << std::fixed << std::setprecision(2) << "  " << std::left << std::setw(24) << name << " "
+				<< std::setw(10) << orderName << " " << rate << " Mrays/s, per ray " << perRay(stats.nodeCount)
+				<< " nodes, " << perRay(stats.leafCount) << " leaves, " << perRay(stats.triangleCount)
+				<< " triangles\n";
+		}
+		scene.bvh.setTraversalOrder(sceneTraversalOrder);
+	}
+
+	// Same traversal and leaves, the BVH only has to be built with a leaf pack width
+	template <uint32_t Width>
+	void compareLeafPacks(const std::vector<TrianglePack<Width>>& packs) const
+	{
+		const auto& triangles = scene.intersections.triangles;
+		const auto& materials = scene.materials;
+		const std::string widthName = std::to_string(Width) + "-wide packs";
+
+		const auto singleClosestHit = [&](Ray& ray)
+		{
+			return scene.bvh.traverse(ray, BVH::ClosestHitPolicy{triangles, materials, ray});
+		};
+		const auto packedClosestHit = [&](Ray& ray)
+		{
+			return scene.bvh.traverse(ray, BVH::PackedClosestHitPolicy<Width>(packs, ray));
+		};
+		const auto singleAnyHit = [&](Ray& ray)
+		{
+			return scene.bvh.traverse(ray, BVH::AnyHitPolicy{triangles, materials, ray});
+		};
+		const auto packedAnyHit = [&](Ray& ray)
+		{
+			return scene.bvh.traverse(ray, BVH::PackedAnyHitPolicy<Width>(packs, ray));
+		};
+
+		compareLeafPacks(widthName, "closest hit, primary", primaryRays, singleClosestHit, packedClosestHit);
+		compareLeafPacks(widthName, "closest hit, secondary", secondaryRays, singleClosestHit, packedClosestHit);
+		compareLeafPacks(widthName, "any hit, secondary", secondaryRays, singleAnyHit, packedAnyHit);
+	}
+
+	template <typename SingleQuery, typename PackedQuery>
+	void compareLeafPacks(const std::string& widthName, const std::string& name, const std::vector<Ray>& rays,
+	                      SingleQuery&& singleQuery, PackedQuery&& packedQuery) const
+	{
+		uint64_t singleChecksum = 0;
+		uint64_t packedChecksum = 0;
+		const double singleRate = measureQuery(rays, singleChecksum, singleQuery);
+		const double packedRate = measureQuery(rays, packedChecksum, packedQuery);
+
+		std::cout << std::fixed << std::setprecision(2) << "  " << std::left << std::setw(24) << name
+			<< " triangles " << singleRate << " Mrays/s, " << widthName << " " << packedRate
+			<< " Mrays/s, speedup " << packedRate / singleRate << "x\n";
+
+		if (singleChecksum != packedChecksum)
+			std::cerr << "  " << name << ": results of the triangle packs differ\n";
+	}
+
+	// Best rate in Mrays/s of query over a few repetitions
+	template <typename Query>
+	double measureQuery(const std::vector<Ray>& rays, uint64_t& checksum, Query&& query) const
+	{
+		double bestSeconds = std::numeric_limits<double>::max();
+		for (uint32_t repetition = 0; repetition < repetitionCount; ++repetition)
+		{
+			checksum = 0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (Ray ray : rays)
+			{
+				const HitInfo hitInfo = query(ray);
+				checksum += hitInfo.hit ? 1 + hitInfo.triangleIndex : 0;
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			std::chrono::duration<double> duration = end - start;
+			bestSeconds = std::min(bestSeconds, duration.count());
+		}
+		return static_cast<double>(rays.size()) / bestSeconds * 1e-6;
+	}
+
+	// Returns the best rate in Mrays/s over a few repetitions, wrap turns the policy into the leaf callable
+	template <typename LeafPolicy, typename Wrap>
+	double measure(const std::vector<Ray>& rays, uint64_t& checksum, Wrap&& wrap) const
+	{
+		double bestSeconds = std::numeric_limits<double>::max();
+		for (uint32_t repetition = 0; repetition < repetitionCount; ++repetition)
+		{
+			checksum = 0;
+			auto start = std::chrono::high_resolution_clock::now();
+			for (Ray ray : rays)
+			{
+				uint32_t hitCount = 0;
+				HitInfo hitInfo = scene.bvh.traverse(ray, wrap(makePolicy<LeafPolicy>(ray, hitCount)));
+				checksum += (hitInfo.hit ? 1 : 0) + hitCount;
+				if constexpr (std::is_same_v<LeafPolicy, BVH::ClosestHitPolicy>)
+					checksum += hitInfo.hit ? hitInfo.triangleIndex : 0;
+			}
+			auto end = std::chrono::high_resolution_clock::now();
+
+			std::chrono::duration<double> duration = end - start;
+			bestSeconds = std::min(bestSeconds, duration.count());
+		}
+		return static_cast<double>(rays.size()) / bestSeconds * 1e-6;
+	}
+
+	template <typename LeafPolicy>
+	LeafPolicy makePolicy(Ray& ray, uint32_t& hitCount) const
+	{
+		if constexpr (std::is_same_v<LeafPolicy, BVH::CountAllPolicy>)
+			return {scene.intersections.triangles, scene.materials, ray, hitCount};
+		else
+			return {scene.intersections.triangles, scene.materials, ray};
+	}
+
+	static constexpr uint32_t repetitionCount = 3;
+
+	Scene& scene;
+	std::vector<Ray> primaryRays;
+	std::vector<Ray> secondaryRays;
+};
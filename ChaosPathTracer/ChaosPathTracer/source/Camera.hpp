@@ -18,4 +18,33 @@ public:
 	{
 		return Normalize(transform * Vector3(0.f, 0.f, -1.f));
 	}
+
+	// Screen space point of the image position (x, y) in pixels, x scaled by the aspect ratio
+	static Vector2 toScreenSpace(float x, float y, uint32_t imageWidth, uint32_t imageHeight)
+	{
+		y /= static_cast<float>(imageHeight); // To NDC
+		y = 1.f - (2.f * y); // To screen space
+
+		x /= static_cast<float>(imageWidth); // To NDC
+		x = 2.f * x - 1.f; // To screen space
+		x *= static_cast<float>(imageWidth) / static_cast<float>(imageHeight); // Consider aspect ratio
+
+		return {x, y};
+	}
+
+	// Ray through the screen space point (x, y), x already scaled by the aspect ratio
+	Ray generateRay(float x, float y) const
+	{
+		Vector3 origin = getPosition();
+		Vector3 forward = getLookDirection();
+
+		// Assume up vector is Y axis in camera space and right vector is X axis in camera space
+		Vector3 up = Normalize(transform * Vector3(0.f, 1.f, 0.f));
+		Vector3 right = Cross(forward, up);
+
+		// Calculate direction to pixel in camera space
+		Vector3 direction = Normalize(forward + right * x + up * y);
+
+		return Ray{origin, direction};
+	}
 };
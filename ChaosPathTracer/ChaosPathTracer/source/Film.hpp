@@ -0,0 +1,140 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "Image.hpp"
+#include "Math3D.hpp"
+
+// HDR accumulation buffer of a render. Every pixel keeps the sum of the radiance of its samples, the sum of their
+// squared luminance and their count, so that passes of any number of samples can be added, the image can be
+// developed after any of them, and adaptive sampling can estimate the error of every pixel
+class Film
+{
+public:
+	Film(uint32_t width, uint32_t height) : width(width), height(height)
+	{
+		radianceSums.resize(width * height, Vector3{0.f});
+		luminanceSquaredSums.resize(width * height, 0.f);
+		sampleCounts.resize(width * height, 0);
+		converged.resize(width * height, false);
+	}
+
+	// Not synchronized, the threads must add to disjoint pixels
+	void addSample(uint32_t x, uint32_t y, const Vector3& radiance)
+	{
+		const float luminance = getLuminance(radiance);
+		radianceSums[y * width + x] += radiance;
+		luminanceSquaredSums[y * width + x] += luminance * luminance;
+		++sampleCounts[y * width + x];
+	}
+
+	// Mean radiance of the samples, black without any
+	Vector3 getPixel(uint32_t x, uint32_t y) const
+	{
+		const uint32_t sampleCount = sampleCounts[y * width + x];
+		if (sampleCount == 0)
+			return Vector3{0.f};
+
+		return radianceSums[y * width + x] / static_cast<float>(sampleCount);
+	}
+
+	uint32_t getSampleCount(uint32_t x, uint32_t y) const
+	{
+		return sampleCounts[y * width + x];
+	}
+
+	uint32_t getMaxSampleCount() const
+	{
+		return sampleCounts.empty() ? 0 : *std::ranges::max_element(sampleCounts);
+	}
+
+	// Converged pixels take no more samples, see updateConvergence
+	bool isConverged(uint32_t x, uint32_t y) const
+	{
+		return converged[y * width + x];
+	}
+
+	bool isConverged(uint32_t startRow, uint32_t endRow, uint32_t startColumn, uint32_t endColumn) const
+	{
+		for (uint32_t y = startRow; y < endRow; ++y)
+		{
+			for (uint32_t x = startColumn; x < endColumn; ++x)
+			{
+				if (!converged[y * width + x])
+					return false;
+			}
+		}
+		return true;
+	}
+
+	// Marks the pixels of at least minSampleCount samples whose standard error of the mean luminance is below
+	// errorThreshold relative to the mean. Dark pixels are compared with darkLuminance instead, as their relative
+	// error never settles. Returns the number of converged pixels
+	uint32_t updateConvergence(float errorThreshold, uint32_t minSampleCount)
+	{
+		uint32_t convergedCount = 0;
+		for (uint32_t pixelIndex = 0; pixelIndex < sampleCounts.size(); ++pixelIndex)
+		{
+			const uint32_t sampleCount = sampleCounts[pixelIndex];
+			if (!converged[pixelIndex] && sampleCount >= std::max(minSampleCount, 2u))
+			{
+				const float mean = getLuminance(radianceSums[pixelIndex]) / static_cast<float>(sampleCount);
+				const float meanSquare = luminanceSquaredSums[pixelIndex] / static_cast<float>(sampleCount);
+				const float variance = std::max(0.f, meanSquare - mean * mean) * static_cast<float>(sampleCount) /
+					static_cast<float>(sampleCount - 1);
+				const float standardError = std::sqrt(variance / static_cast<float>(sampleCount));
+				converged[pixelIndex] = standardError <= errorThreshold * std::max(mean, darkLuminance);
+			}
+			convergedCount += converged[pixelIndex];
+		}
+		return convergedCount;
+	}
+
+	// Quantized image of the samples added so far
+	Image develop() const
+	{
+		Image image(width, height);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+				image.setPixel(x, y, getPixel(x, y).toRGB());
+		}
+		return image;
+	}
+
+	// Heatmap of the sample counts, from blue for no samples over green to red for maxSampleCount
+	Image developSampleCounts(uint32_t maxSampleCount) const
+	{
+		Image image(width, height);
+		for (uint32_t y = 0; y < height; ++y)
+		{
+			for (uint32_t x = 0; x < width; ++x)
+			{
+				const float t = std::min(1.f, static_cast<float>(getSampleCount(x, y)) /
+				                         static_cast<float>(std::max(maxSampleCount, 1u)));
+				image.setPixel(x, y, Vector3{t, 1.f - std::abs(2.f * t - 1.f), 1.f - t}.toRGB());
+			}
+		}
+		return image;
+	}
+
+	uint32_t GetWidth() const { return width; }
+	uint32_t GetHeight() const { return height; }
+
+private:
+	static float getLuminance(const Vector3& radiance)
+	{
+		return 0.2126f * radiance.x + 0.7152f * radiance.y + 0.0722f * radiance.z;
+	}
+
+	static constexpr float darkLuminance = 0.05f;
+
+	uint32_t width, height;
+	std::vector<Vector3> radianceSums;
+	std::vector<float> luminanceSquaredSums;
+	std::vector<uint32_t> sampleCounts;
+	std::vector<bool> converged;
+};
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <vector>
+
+#include "AABB.hpp"
+#include "BVH.hpp"
+
+// Object space geometry with its own bottom-level BVH, shared by all instances referencing it
+struct Mesh
+{
+	VertexBuffer vertices;
+	std::vector<Triangle> triangles;
+	IntersectionBuffer intersections; // hot copy of the triangles for the BVH
+	std::vector<uint32_t> triangleOrder; // source index of every triangle, see BVH
+	BVH bvh;
+	AABB boundingBox;
+};
+
+// Placement of a mesh in the world, the primitive of the top-level BVH
+struct Instance
+{
+	uint32_t meshIndex;
+	Matrix4 objectToWorld;
+	Matrix4 worldToObject;
+	int32_t emissiveOffset = -1; // emissive sampler index of the first emissive triangle of this instance
+
+	Instance(uint32_t meshIndex, const Matrix4& objectToWorld)
+		: meshIndex(meshIndex), objectToWorld(objectToWorld), worldToObject(InverseAffine(objectToWorld))
+	{
+	}
+
+	// The direction is not renormalized, so distances along the object space ray match the world space ones
+	Ray toObject(const Ray& ray) const
+	{
+		return Ray{transformPoint(worldToObject, ray.origin), worldToObject * ray.directionN, ray.maxT};
+	}
+
+	Vector3 pointToWorld(const Vector3& point) const
+	{
+		return transformPoint(objectToWorld, point);
+	}
+
+	Vector3 normalToWorld(const Vector3& normal) const
+	{
+		return Normalize(Transpose(worldToObject) * normal);
+	}
+
+	AABB worldBounds(const AABB& objectBounds) const
+	{
+		AABB result;
+		for (uint32_t corner = 0; corner < 8; ++corner)
+		{
+			Vector3 point{
+				corner & 1 ? objectBounds.maxPoint.x : objectBounds.minPoint.x,
+				corner & 2 ? objectBounds.maxPoint.y : objectBounds.minPoint.y,
+				corner & 4 ? objectBounds.maxPoint.z : objectBounds.minPoint.z
+			};
+			point = pointToWorld(point);
+			result |= AABB(point, point);
+		}
+		return result;
+	}
+
+private:
+	static Vector3 transformPoint(const Matrix4& matrix, const Vector3& point)
+	{
+		return matrix * Point3(point.x, point.y, point.z);
+	}
+};
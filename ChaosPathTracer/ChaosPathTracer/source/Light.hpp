@@ -15,11 +15,24 @@ struct EmissiveLightSample
 	float pdf;
 };
 
+// World space copy of an emissive triangle, instances of an emissive mesh each get their own
 struct EmissiveTriangle
 {
-	Triangle triangle;
+	Vector3 v0;
+	Vector3 v1;
+	Vector3 v2;
+	Vector3 faceNormal;
+	float area;
 	Vector3 emission;
 
+	EmissiveTriangle(const Vector3& v0, const Vector3& v1, const Vector3& v2, const Vector3& emission)
+		: v0(v0), v1(v1), v2(v2), emission(emission)
+	{
+		const Vector3 normal = Cross(v1 - v0, v2 - v0);
+		faceNormal = Normalize(normal);
+		area = normal.magnitude() * 0.5f;
+	}
+
 	EmissiveLightSample sample(const Vector3& posW, const Vector2& rnd) const
 	{
 		float u = rnd.x;
@@ -34,16 +47,15 @@ struct EmissiveTriangle
 		float w = 1.0f - u - v;
 
 		Vector3 sampledPosition = {
-			u * triangle.v0.position.x + v * triangle.v1.position.x + w * triangle.v2.position.x,
-			u * triangle.v0.position.y + v * triangle.v1.position.y + w * triangle.v2.position.y,
-			u * triangle.v0.position.z + v * triangle.v1.position.z + w * triangle.v2.position.z
+			u * v0.x + v * v1.x + w * v2.x,
+			u * v0.y + v * v1.y + w * v2.y,
+			u * v0.z + v * v1.z + w * v2.z
 		};
 
 		Vector3 toLight = sampledPosition - posW;
 		float distSqr = std::max(FLT_MIN, Dot(toLight, toLight));
 
-		float area = triangle.area();
-		float cosTheta = Dot(triangle.faceNormal, -toLight);
+		float cosTheta = Dot(faceNormal, -toLight);
 		float pdf = distSqr / (cosTheta * area);
 
 		EmissiveLightSample sample;
@@ -57,8 +69,7 @@ struct EmissiveTriangle
 	{
 		Vector3 toLight = sampledPosition - posW;
 		float distSqr = std::max(FLT_MIN, Dot(toLight, toLight));
-		float area = triangle.area();
-		float cosTheta = Dot(triangle.faceNormal, -toLight);
+		float cosTheta = Dot(faceNormal, -toLight);
 
 		return distSqr / (cosTheta * area);
 	}
@@ -1,12 +1,14 @@
 #include <iostream>
 
+#include "Benchmark.hpp"
 #include "Renderer.hpp"
 
 int main(int argc, char** argv)
 {        
 	if (argc < 2) 
 	{
-		std::cerr << "Usage: " << argv[0] << " <scene-file>" << std::endl;
+		std::cerr << "Usage: " << argv[0] << " <scene-file> [--benchmark]" << std::endl;
+		std::cerr << "       " << argv[0] << " <frame-file> <frame-file>..." << std::endl;
 		return 1;
 	}
 
@@ -15,16 +17,38 @@ int main(int argc, char** argv)
 		std::string sceneFile = argv[1];
 		std::unique_ptr<Scene> scene = std::make_unique<Scene>(sceneFile);
 
-		Renderer renderer(*scene);
+		if (argc > 2 && std::string(argv[2]) == "--benchmark")
+		{
+			TraversalBenchmark benchmark(*scene);
+			benchmark.run();
+			return 0;
+		}
 
-		auto start = std::chrono::high_resolution_clock::now();
+		// Further scene files are the next frames of an animation
+		for (int frameIdx = 1; frameIdx < argc; ++frameIdx)
+		{
+			if (frameIdx > 1)
+			{
+				auto loadStart = std::chrono::high_resolution_clock::now();
+				scene->loadFrame(argv[frameIdx]);
+				auto loadEnd = std::chrono::high_resolution_clock::now();
 
-		renderer.renderImage();
+				std::chrono::duration<double> loadDuration = loadEnd - loadStart;
+				std::cout << scene->settings.sceneName + " loading time: " << loadDuration.count() << " seconds"
+					<< std::endl;
+			}
 
-		auto end = std::chrono::high_resolution_clock::now();
+			Renderer renderer(*scene);
 
-		std::chrono::duration<double> duration = end - start;
-		std::cout << scene->settings.sceneName + " rendering time: " << duration.count() << " seconds" << std::endl;
+			auto start = std::chrono::high_resolution_clock::now();
+
+			renderer.renderImage();
+
+			auto end = std::chrono::high_resolution_clock::now();
+
+			std::chrono::duration<double> duration = end - start;
+			std::cout << scene->settings.sceneName + " rendering time: " << duration.count() << " seconds" << std::endl;
+		}
 	} 
 	catch (const std::runtime_error& e) 
 	{
@@ -7,6 +7,7 @@
 #include <algorithm>
 #include <random>
 #include <stdexcept>
+#include <vector>
 
 constexpr float PI = std::numbers::pi_v<float>;
 
@@ -287,6 +288,10 @@ inline Vector3 OffsetRayOrigin(const Vector3& origin, const Vector3& normal)
 	return origin + normal * rayOffset;
 }
 
+// Relative distance by which shadow rays towards a sampled point on an emissive triangle stop short of it, so that
+// the triangle does not occlude its own sample
+constexpr float SHADOW_RAY_EPSILON = 1e-4f;
+
 struct Ray
 {
 	Vector3 origin;
@@ -315,102 +320,231 @@ struct HitInfo
 	Vector2 barycentrics;
 	uint32_t materialIndex;
 	uint32_t triangleIndex;
+	int32_t instanceIndex = -1; // -1 -> triangleIndex refers to the scene triangles, not to an instanced mesh
 };
 
-struct Vertex
+// Unit vector folded onto an octahedron and unfolded into a square, 16 bits per square coordinate
+inline uint32_t EncodeOctahedral(const Vector3& n)
 {
-	Vector3 position;
-	Vector3 normal;
-	Vector2 uv;
+	const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+	if (!(l1 > 0.f))
+		return EncodeOctahedral(Vector3(0.f, 0.f, 1.f));
+
+	float u = n.x / l1;
+	float v = n.y / l1;
+	if (n.z < 0.f)
+	{
+		const float foldedU = (1.f - std::abs(v)) * (u >= 0.f ? 1.f : -1.f);
+		const float foldedV = (1.f - std::abs(u)) * (v >= 0.f ? 1.f : -1.f);
+		u = foldedU;
+		v = foldedV;
+	}
+
+	const auto quantize = [](float f)
+	{
+		return static_cast<uint32_t>(std::lround((std::clamp(f, -1.f, 1.f) * 0.5f + 0.5f) * 65535.f));
+	};
+	return quantize(u) | quantize(v) << 16;
+}
+
+inline Vector3 DecodeOctahedral(uint32_t encoded)
+{
+	const float u = static_cast<float>(encoded & 0xffff) / 65535.f * 2.f - 1.f;
+	const float v = static_cast<float>(encoded >> 16) / 65535.f * 2.f - 1.f;
+
+	Vector3 n(u, v, 1.f - std::abs(u) - std::abs(v));
+	if (n.z < 0.f)
+	{
+		n.x = (1.f - std::abs(v)) * (u >= 0.f ? 1.f : -1.f);
+		n.y = (1.f - std::abs(u)) * (v >= 0.f ? 1.f : -1.f);
+	}
+	return Normalize(n);
+}
+
+// Vertex attributes of a scene or of a mesh, shared by all the triangles meeting at a vertex
+struct VertexBuffer
+{
+	std::vector<Vector3> positions;
+	std::vector<Vector3> normals;
+	std::vector<Vector2> uvs;
+
+	// Replace normals and uvs after compactAttributes: 32-bit octahedral normals, and UVs with 16 bits per
+	// coordinate spread over the UV bounds of the buffer
+	std::vector<uint32_t> compactNormals;
+	std::vector<uint32_t> compactUVs;
+	Vector2 uvOrigin{0.f};
+	Vector2 uvExtent{0.f};
+	bool compact = false;
+
+	Vector3 getNormal(uint32_t vertexIndex) const
+	{
+		return compact ? DecodeOctahedral(compactNormals[vertexIndex]) : normals[vertexIndex];
+	}
+
+	Vector2 getUV(uint32_t vertexIndex) const
+	{
+		if (!compact)
+			return uvs[vertexIndex];
+
+		const uint32_t encoded = compactUVs[vertexIndex];
+		const Vector2 unit(static_cast<float>(encoded & 0xffff) / 65535.f, static_cast<float>(encoded >> 16) / 65535.f);
+		return uvOrigin + unit * uvExtent;
+	}
+
+	// Encodes the normals and UVs and frees the full precision ones, the positions are kept as they are since
+	// the BVH and the intersection records are built from them
+	void compactAttributes()
+	{
+		if (compact)
+			return;
+
+		compactNormals.resize(normals.size());
+		for (size_t vertexIndex = 0; vertexIndex < normals.size(); ++vertexIndex)
+			compactNormals[vertexIndex] = EncodeOctahedral(normals[vertexIndex]);
+
+		Vector2 uvMin(std::numeric_limits<float>::max());
+		Vector2 uvMax(std::numeric_limits<float>::lowest());
+		for (const auto& uv : uvs)
+		{
+			uvMin = Vector2(std::min(uvMin.x, uv.x), std::min(uvMin.y, uv.y));
+			uvMax = Vector2(std::max(uvMax.x, uv.x), std::max(uvMax.y, uv.y));
+		}
+		if (!uvs.empty())
+		{
+			uvOrigin = uvMin;
+			uvExtent = uvMax - uvMin;
+		}
+
+		const auto quantize = [](float f, float origin, float extent)
+		{
+			return extent > 0.f ? static_cast<uint32_t>(std::lround((f - origin) / extent * 65535.f)) : 0u;
+		};
+		compactUVs.resize(uvs.size());
+		for (size_t vertexIndex = 0; vertexIndex < uvs.size(); ++vertexIndex)
+		{
+			const Vector2& uv = uvs[vertexIndex];
+			compactUVs[vertexIndex] =
+				quantize(uv.x, uvOrigin.x, uvExtent.x) | quantize(uv.y, uvOrigin.y, uvExtent.y) << 16;
+		}
+
+		std::vector<Vector3>().swap(normals);
+		std::vector<Vector2>().swap(uvs);
+		compact = true;
+	}
+
+	size_t getMemorySize() const
+	{
+		return positions.capacity() * sizeof(Vector3) + normals.capacity() * sizeof(Vector3) +
+			uvs.capacity() * sizeof(Vector2) + compactNormals.capacity() * sizeof(uint32_t) +
+			compactUVs.capacity() * sizeof(uint32_t);
+	}
 };
 
+// Corners of a triangle as indices into a vertex buffer
 struct Triangle
 {
-	Vertex v0;
-	Vertex v1;
-	Vertex v2;
+	uint32_t indices[3];
 
 	uint32_t materialIndex;
 
-	Vector3 faceNormal;
-
 	int32_t emissiveIndex = -1;
 
-	Triangle(const Vertex& a, const Vertex& b, const Vertex& c, uint32_t materialIndex, int32_t emissiveIndex)
-		: v0(a), v1(b), v2(c), materialIndex(materialIndex), emissiveIndex(emissiveIndex)
+	Triangle(uint32_t i0, uint32_t i1, uint32_t i2, uint32_t materialIndex, int32_t emissiveIndex)
+		: indices{i0, i1, i2}, materialIndex(materialIndex), emissiveIndex(emissiveIndex)
 	{
-		this->faceNormal = Normalize(Cross(v1.position - v0.position, v2.position - v0.position));
 	}
 
-	Vector3 centroid() const
+	const Vector3& getPosition(const VertexBuffer& vertices, uint32_t corner) const
 	{
-		return (v0.position + v1.position + v2.position) / 3.f;
+		return vertices.positions[indices[corner]];
 	}
 
-	float area() const
+	Vector3 centroid(const VertexBuffer& vertices) const
 	{
-		return Cross(v1.position - v0.position, v2.position - v0.position).magnitude() * 0.5f;
+		return (getPosition(vertices, 0) + getPosition(vertices, 1) + getPosition(vertices, 2)) / 3.f;
 	}
 
-	Vector3 getNormal(const Vector2& barycentrics) const
+	Vector3 getNormal(const VertexBuffer& vertices, const Vector2& barycentrics) const
 	{
 		float w = 1.f - barycentrics.x - barycentrics.y;
-		return Normalize(v1.normal * barycentrics.x + v2.normal * barycentrics.y + v0.normal * w);
+		return Normalize(vertices.getNormal(indices[1]) * barycentrics.x +
+			vertices.getNormal(indices[2]) * barycentrics.y + vertices.getNormal(indices[0]) * w);
 	}
 
-	Vector2 getUVs(const Vector2& barycentrics) const
+	Vector2 getUVs(const VertexBuffer& vertices, const Vector2& barycentrics) const
 	{
 		float w = 1.f - barycentrics.x - barycentrics.y;
-		return v1.uv * barycentrics.x + v2.uv * barycentrics.y + v0.uv * w;
+		return vertices.getUV(indices[1]) * barycentrics.x + vertices.getUV(indices[2]) * barycentrics.y +
+			vertices.getUV(indices[0]) * w;
 	}
 
-	HitInfo intersect(const Ray& ray, bool backFaceCull) const
+	bool operator==(const Triangle& other) const
 	{
-		HitInfo info;
+		return indices[0] == other.indices[0] && indices[1] == other.indices[1] && indices[2] == other.indices[2] &&
+			materialIndex == other.materialIndex && emissiveIndex == other.emissiveIndex;
+	}
+};
 
-		const Vector3& a = v0.position;
-		const Vector3& b = v1.position;
-		const Vector3& c = v2.position;
+// Hot part of a triangle for the BVH traversal: the first vertex and the two edges leaving it, tested with the
+// Moller-Trumbore algorithm. Kept in a separate array in the BVH order of the triangles, so that leaf tests do
+// not pull the vertex normals and UVs into the cache. The rest of the triangle is looked up by index for the hit
+struct IntersectionTriangle
+{
+	Vector3 v0;
+	uint32_t materialIndex;
+	Vector3 edge1; // v1 - v0
+	Vector3 edge2; // v2 - v0
 
-		float dirDotNorm = Dot(ray.directionN, faceNormal);
-		if (backFaceCull && dirDotNorm >= 0.f)
-			return info;
+	IntersectionTriangle(const Triangle& triangle, const VertexBuffer& vertices)
+		: v0(triangle.getPosition(vertices, 0)), materialIndex(triangle.materialIndex),
+		edge1(triangle.getPosition(vertices, 1) - v0), edge2(triangle.getPosition(vertices, 2) - v0)
+	{
+	}
 
-		float t = Dot(a - ray.origin, faceNormal) / dirDotNorm;
-		if (t < 0.f || t > ray.maxT)
-			return info;
+	Vector3 getNormal() const
+	{
+		return Normalize(Cross(edge1, edge2));
+	}
 
-		Vector3 p = ray(t);
+	// barycentrics.x is the weight of v1 and barycentrics.y the weight of v2
+	bool intersect(const Ray& ray, bool backFaceCull, float& t, Vector2& barycentrics) const
+	{
+		// The determinant is positive when the ray hits the front face
+		const Vector3 p = Cross(ray.directionN, edge2);
+		const float det = Dot(edge1, p);
+		if (backFaceCull ? det <= 0.f : det == 0.f)
+			return false;
 
-		Vector3 edge0 = b - a;
-		Vector3 edge1 = c - b;
-		Vector3 edge2 = a - c;
-		Vector3 C0 = p - a;
-		Vector3 C1 = p - b;
-		Vector3 C2 = p - c;
+		const float invDet = 1.f / det;
+		const Vector3 s = ray.origin - v0;
+		const float u = Dot(s, p) * invDet;
+		if (u < 0.f || u > 1.f)
+			return false;
 
-		if (Dot(faceNormal, Cross(edge0, C0)) < 0.f)
-			return info;
-		if (Dot(faceNormal, Cross(edge1, C1)) < 0.f)
-			return info;
-		if (Dot(faceNormal, Cross(edge2, C2)) < 0.f)
-			return info;
+		const Vector3 q = Cross(s, edge1);
+		const float v = Dot(ray.directionN, q) * invDet;
+		if (v < 0.f || u + v > 1.f)
+			return false;
 
-		// Calculate the barycentric coordinates
-		float triArea = Magnitude(Cross(b - a, c - a)); // area of the whole triangle
-		info.barycentrics.x = Magnitude(Cross(p - a, c - a)) / triArea;
-		info.barycentrics.y = Magnitude(Cross(b - a, p - a)) / triArea;
+		t = Dot(edge2, q) * invDet;
+		if (t < 0.f || t > ray.maxT)
+			return false;
 
-		info.hit = true;
-		info.t = t;
-		info.point = p;
-		info.normal = faceNormal;
-		info.materialIndex = materialIndex;
+		barycentrics = {u, v};
+		return true;
+	}
 
-		return info;
+	// Occlusion test, same result as intersect
+	bool intersects(const Ray& ray, bool backFaceCull) const
+	{
+		float t;
+		Vector2 barycentrics;
+		return intersect(ray, backFaceCull, t, barycentrics);
 	}
 };
 
+static_assert(sizeof(IntersectionTriangle) == 40);
+
 struct Matrix4
 {
 protected:
@@ -567,6 +701,46 @@ inline Matrix4 operator*(const Matrix4& A, const Matrix4& B)
 	return result;
 }
 
+// Inverse of a matrix with an affine 3x3 part and a translation
+inline Matrix4 InverseAffine(const Matrix4& H)
+{
+	const float a00 = H(1, 1) * H(2, 2) - H(1, 2) * H(2, 1);
+	const float a01 = H(0, 2) * H(2, 1) - H(0, 1) * H(2, 2);
+	const float a02 = H(0, 1) * H(1, 2) - H(0, 2) * H(1, 1);
+	const float a10 = H(1, 2) * H(2, 0) - H(1, 0) * H(2, 2);
+	const float a11 = H(0, 0) * H(2, 2) - H(0, 2) * H(2, 0);
+	const float a12 = H(0, 2) * H(1, 0) - H(0, 0) * H(1, 2);
+	const float a20 = H(1, 0) * H(2, 1) - H(1, 1) * H(2, 0);
+	const float a21 = H(0, 1) * H(2, 0) - H(0, 0) * H(2, 1);
+	const float a22 = H(0, 0) * H(1, 1) - H(0, 1) * H(1, 0);
+
+	const float invDet = 1.f / (H(0, 0) * a00 + H(0, 1) * a10 + H(0, 2) * a20);
+
+	Matrix4 result = {
+		a00 * invDet, a01 * invDet, a02 * invDet, 0.f,
+		a10 * invDet, a11 * invDet, a12 * invDet, 0.f,
+		a20 * invDet, a21 * invDet, a22 * invDet, 0.f,
+		0.f, 0.f, 0.f, 1.f
+	};
+
+	const Vector3 translation = result * Vector3(H(0, 3), H(1, 3), H(2, 3));
+	result(0, 3) = -translation.x;
+	result(1, 3) = -translation.y;
+	result(2, 3) = -translation.z;
+	return result;
+}
+
+inline Matrix4 Transpose(const Matrix4& H)
+{
+	Matrix4 result;
+	for (int i = 0; i < 4; ++i)
+	{
+		for (int j = 0; j < 4; ++j)
+			result(i, j) = H(j, i);
+	}
+	return result;
+}
+
 struct Range
 {
 	uint32_t start;
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Triangle that last blocked a shadow ray, per light. Consecutive shadow rays of one thread towards the same
+// light tend to be blocked by the same triangle, which is tested before the BVH is traversed. Owned by a single
+// thread, see Scene::anyHit
+class OccluderCache final
+{
+public:
+	struct Occluder
+	{
+		int32_t instanceIndex = -1; // -1 -> triangleIndex refers to the scene triangles
+		uint32_t triangleIndex = std::numeric_limits<uint32_t>::max(); // max -> nothing cached yet
+
+		bool isValid() const
+		{
+			return triangleIndex != std::numeric_limits<uint32_t>::max();
+		}
+	};
+
+	struct Stats
+	{
+		uint64_t queryCount = 0;
+		uint64_t occludedCount = 0;
+		uint64_t cacheHitCount = 0; // occluded queries answered by the cached triangle
+
+		Stats& operator+=(const Stats& other)
+		{
+			queryCount += other.queryCount;
+			occludedCount += other.occludedCount;
+			cacheHitCount += other.cacheHitCount;
+			return *this;
+		}
+	};
+
+	// One slot per point light and one shared by the samples of the emissive geometry
+	explicit OccluderCache(size_t pointLightCount)
+		: occluders(pointLightCount + 1)
+	{
+	}
+
+	Occluder& getPointLightOccluder(size_t lightIndex)
+	{
+		return occluders[lightIndex];
+	}
+
+	Occluder& getEmissiveOccluder()
+	{
+		return occluders.back();
+	}
+
+	Stats stats;
+
+private:
+	std::vector<Occluder> occluders;
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include "AABB.hpp"
+
+// Binary BVH node with its bounds quantized to 8/16 bits relative to the decoded bounds of its parent.
+// The topology matches BVHNode, so the depth-first order and the child offsets are kept as they are
+template <typename T>
+struct alignas(sizeof(T) == 1 ? 16 : 4) QuantizedBVHNode
+{
+	static constexpr uint32_t maxQuantizedValue = std::numeric_limits<T>::max();
+
+	union
+	{
+		uint32_t primitivesOffset; // leaf;
+		uint32_t secondChildOffset; // interior
+	};
+
+	uint16_t primitiveCount; // 0 -> interior node
+	uint8_t splitAxis;
+
+	T quantizedBounds[2][3]; // [min/max][axis]
+
+	bool isLeaf() const
+	{
+		return primitiveCount != 0;
+	}
+
+	// Rounds outwards, the decoded box always contains the encoded one. The box has to lie inside the
+	// parent box, up to float rounding of the decoded parent bounds
+	void encode(const AABB& boundingBox, const AABB& parentBox)
+	{
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			const float parentMin = parentBox.minPoint[axis];
+			const float scale = getScale(parentBox, axis);
+			const float invScale = scale > 0.f ? 1.f / scale : 0.f;
+
+			auto quantizedMin = static_cast<uint32_t>(std::clamp(
+				std::floor((boundingBox.minPoint[axis] - parentMin) * invScale), 0.f, maxQuantizedFloat));
+			while (quantizedMin > 0 && dequantize(quantizedMin, parentMin, scale) > boundingBox.minPoint[axis])
+				--quantizedMin;
+
+			auto quantizedMax = static_cast<uint32_t>(std::clamp(
+				std::ceil((boundingBox.maxPoint[axis] - parentMin) * invScale), 0.f, maxQuantizedFloat));
+			while (quantizedMax < maxQuantizedValue &&
+				dequantize(quantizedMax, parentMin, scale) < boundingBox.maxPoint[axis])
+				++quantizedMax;
+
+			quantizedBounds[0][axis] = static_cast<T>(quantizedMin);
+			quantizedBounds[1][axis] = static_cast<T>(quantizedMax);
+		}
+	}
+
+	AABB decode(const AABB& parentBox) const
+	{
+		AABB boundingBox;
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			const float scale = getScale(parentBox, axis);
+			boundingBox.minPoint[axis] = dequantize(quantizedBounds[0][axis], parentBox.minPoint[axis], scale);
+			boundingBox.maxPoint[axis] = dequantize(quantizedBounds[1][axis], parentBox.minPoint[axis], scale);
+		}
+		return boundingBox;
+	}
+
+private:
+	static constexpr float maxQuantizedFloat = static_cast<float>(maxQuantizedValue);
+	static constexpr float invMaxQuantizedFloat = 1.f / maxQuantizedFloat;
+
+	static float getScale(const AABB& parentBox, uint8_t axis)
+	{
+		return (parentBox.maxPoint[axis] - parentBox.minPoint[axis]) * invMaxQuantizedFloat;
+	}
+
+	static float dequantize(uint32_t quantizedValue, float parentMin, float scale)
+	{
+		return parentMin + static_cast<float>(quantizedValue) * scale;
+	}
+};
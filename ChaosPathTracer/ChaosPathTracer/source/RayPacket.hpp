@@ -0,0 +1,179 @@
+#pragma once
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+
+#include "AABB.hpp"
+#include "SIMD.hpp"
+
+// Up to Width coherent rays, e.g. the primary rays of a pixel tile, stored as structure of arrays so that
+// one SIMD test covers the box or triangle for all of them. Lanes outside activeMask carry no ray
+template <uint32_t Width>
+struct alignas(32) RayPacket
+{
+	using FloatW = typename SIMD::FloatN<Width>::Type;
+
+	RayPacket()
+	{
+		// Inactive lanes never hit anything, maxT is below every entry distance
+		for (uint32_t lane = 0; lane < Width; ++lane)
+		{
+			for (uint8_t axis = 0; axis < 3; ++axis)
+			{
+				origin[axis][lane] = 0.f;
+				direction[axis][lane] = 1.f;
+				directionInv[axis][lane] = 1.f;
+			}
+			maxT[lane] = -1.f;
+		}
+	}
+
+	void setRay(uint32_t lane, const Ray& ray)
+	{
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			origin[axis][lane] = ray.origin[axis];
+			direction[axis][lane] = ray.directionN[axis];
+			directionInv[axis][lane] = ray.directionNInv[axis];
+		}
+		maxT[lane] = ray.maxT;
+		includeInInterval(lane);
+		activeMask |= 1u << lane;
+	}
+
+	// The lane as a single ray, limited to the closest hit found for it so far
+	Ray getRay(uint32_t lane) const
+	{
+		return Ray{Vector3(origin[0][lane], origin[1][lane], origin[2][lane]),
+		           Vector3(direction[0][lane], direction[1][lane], direction[2][lane]), maxT[lane]};
+	}
+
+	// Interval arithmetic test of the whole packet against the box, false only when every ray misses it.
+	// Needs a common origin and the same direction signs in all lanes, and passes otherwise
+	bool mayIntersect(const AABB& boundingBox) const
+	{
+		if (!coherent)
+			return true;
+
+		float tNear = 0.f;
+		float tFar = std::numeric_limits<float>::max();
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			const bool negative = directionNegative[axis];
+			const float nearPlane = (negative ? boundingBox.maxPoint : boundingBox.minPoint)[axis] - commonOrigin[axis];
+			const float farPlane = (negative ? boundingBox.minPoint : boundingBox.maxPoint)[axis] - commonOrigin[axis];
+
+			// Lowest entry and highest exit distance over the interval of the inverse directions
+			const float t1 = nearPlane * (nearPlane >= 0.f ? minDirectionInv[axis] : maxDirectionInv[axis]);
+			const float t2 = farPlane * (farPlane >= 0.f ? maxDirectionInv[axis] : minDirectionInv[axis]);
+
+			// Accumulator goes first, so NaNs from 0 * inf keep the previous value
+			tNear = std::max(tNear, t1);
+			tFar = std::min(tFar, t2 * (1.f + std::numeric_limits<float>::epsilon()));
+		}
+
+		return tNear <= tFar;
+	}
+
+	// Bit mask of the lanes in laneMask whose ray hits the box within [0, maxT], same test as AABB::intersect
+	uint32_t intersect(const AABB& boundingBox, uint32_t laneMask) const
+	{
+		FloatW tNear = FloatW::broadcast(0.f);
+		FloatW tFar = FloatW::load(maxT);
+		const FloatW farScale = FloatW::broadcast(1.f + std::numeric_limits<float>::epsilon());
+
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			const FloatW rayOrigin = FloatW::load(origin[axis]);
+			const FloatW rayDirectionInv = FloatW::load(directionInv[axis]);
+			const FloatW t1 = (FloatW::broadcast(boundingBox.minPoint[axis]) - rayOrigin) * rayDirectionInv;
+			const FloatW t2 = (FloatW::broadcast(boundingBox.maxPoint[axis]) - rayOrigin) * rayDirectionInv;
+
+			tNear = SIMD::max(SIMD::min(t1, t2), tNear);
+			tFar = SIMD::min(SIMD::max(t1, t2) * farScale, tFar);
+		}
+
+		return SIMD::lessMask(tNear, tFar) & laneMask;
+	}
+
+	// Bit mask of the lanes in laneMask that hit the triangle closer than their maxT, with the same Moller-Trumbore
+	// test as IntersectionTriangle::intersect. tHit receives the hit distances
+	uint32_t intersect(const IntersectionTriangle& triangle, bool backFaceCull, uint32_t laneMask, float* tHit) const
+	{
+		const FloatW zero = FloatW::broadcast(0.f);
+		const FloatW one = FloatW::broadcast(1.f);
+		const FloatW edge1[3] = {FloatW::broadcast(triangle.edge1.x), FloatW::broadcast(triangle.edge1.y),
+		                         FloatW::broadcast(triangle.edge1.z)};
+		const FloatW edge2[3] = {FloatW::broadcast(triangle.edge2.x), FloatW::broadcast(triangle.edge2.y),
+		                         FloatW::broadcast(triangle.edge2.z)};
+		const FloatW rayDirection[3] = {FloatW::load(direction[0]), FloatW::load(direction[1]),
+		                                FloatW::load(direction[2])};
+
+		// p = Cross(direction, edge2)
+		const FloatW p[3] = {rayDirection[1] * edge2[2] - rayDirection[2] * edge2[1],
+		                     rayDirection[2] * edge2[0] - rayDirection[0] * edge2[2],
+		                     rayDirection[0] * edge2[1] - rayDirection[1] * edge2[0]};
+		const FloatW det = edge1[0] * p[0] + edge1[1] * p[1] + edge1[2] * p[2];
+		laneMask &= backFaceCull ? SIMD::lessMask(zero, det) : SIMD::lessMask(zero, det) | SIMD::lessMask(det, zero);
+		if (laneMask == 0)
+			return 0;
+
+		const FloatW invDet = one / det;
+		const FloatW s[3] = {FloatW::load(origin[0]) - FloatW::broadcast(triangle.v0.x),
+		                     FloatW::load(origin[1]) - FloatW::broadcast(triangle.v0.y),
+		                     FloatW::load(origin[2]) - FloatW::broadcast(triangle.v0.z)};
+		const FloatW u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+
+		// q = Cross(s, edge1)
+		const FloatW q[3] = {s[1] * edge1[2] - s[2] * edge1[1],
+		                     s[2] * edge1[0] - s[0] * edge1[2],
+		                     s[0] * edge1[1] - s[1] * edge1[0]};
+		const FloatW v = (rayDirection[0] * q[0] + rayDirection[1] * q[1] + rayDirection[2] * q[2]) * invDet;
+		const FloatW t = (edge2[0] * q[0] + edge2[1] * q[1] + edge2[2] * q[2]) * invDet;
+
+		laneMask &= ~(SIMD::lessMask(u, zero) | SIMD::lessMask(v, zero) | SIMD::lessMask(one, u + v) |
+			SIMD::lessMask(t, zero)) & SIMD::lessMask(t, FloatW::load(maxT));
+
+		t.store(tHit);
+		return laneMask;
+	}
+
+	float origin[3][Width];
+	float direction[3][Width];
+	float directionInv[3][Width];
+	float maxT[Width];
+	uint32_t activeMask = 0;
+
+private:
+	// Widens the bounds of the inverse directions used by mayIntersect by the new lane
+	void includeInInterval(uint32_t lane)
+	{
+		if (activeMask == 0)
+		{
+			coherent = true;
+			for (uint8_t axis = 0; axis < 3; ++axis)
+			{
+				commonOrigin[axis] = origin[axis][lane];
+				directionNegative[axis] = directionInv[axis][lane] < 0.f;
+				minDirectionInv[axis] = directionInv[axis][lane];
+				maxDirectionInv[axis] = directionInv[axis][lane];
+			}
+			return;
+		}
+
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			coherent = coherent && origin[axis][lane] == commonOrigin[axis] &&
+				(directionInv[axis][lane] < 0.f) == directionNegative[axis];
+			minDirectionInv[axis] = std::min(minDirectionInv[axis], directionInv[axis][lane]);
+			maxDirectionInv[axis] = std::max(maxDirectionInv[axis], directionInv[axis][lane]);
+		}
+	}
+
+	bool coherent = false;
+	Vector3 commonOrigin;
+	bool directionNegative[3];
+	Vector3 minDirectionInv;
+	Vector3 maxDirectionInv;
+};
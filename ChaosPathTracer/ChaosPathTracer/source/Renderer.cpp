@@ -4,14 +4,17 @@
 #include "Scene.hpp"
 #include "Image.hpp"
 
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
 #include <thread>
 
-void Renderer::writeToFile(const Image& image, const Scene::Settings& sceneSettings)
+void Renderer::writeToFile(const Image& image, const std::string& filename)
 {
 	const auto imageWidth = image.GetWidth();
 	const auto imageHeight = image.GetHeight();
-	PPMWriter writer(sceneSettings.sceneName + "_render", imageWidth, imageHeight,
-	                 maxColorComponent);
+	PPMWriter writer(filename, imageWidth, imageHeight, maxColorComponent);
 
 	// Reserve enough space in the string buffer
 	std::string buffer;
@@ -51,3 +54,62 @@ void Renderer::writeToFile(const Image& image, const Scene::Settings& sceneSetti
 
 	writer << buffer;
 }
+
+void Renderer::printOcclusionStats() const
+{
+	if (occlusionStats.queryCount == 0)
+		return;
+
+	auto percent = [](uint64_t count, uint64_t total)
+	{
+		return total > 0 ? 100.0 * static_cast<double>(count) / static_cast<double>(total) : 0.0;
+	};
+
+	std::cout << scene.settings.sceneName << " shadow rays: " << occlusionStats.queryCount << ", occluded: "
+		<< percent(occlusionStats.occludedCount, occlusionStats.queryCount) << "%, occluder cache hits: "
+		<< percent(occlusionStats.cacheHitCount, occlusionStats.occludedCount) << "% of the occluded\n";
+}
+
+void Renderer::printSampleCountStats(const Film& film) const
+{
+	uint64_t sampleCount = 0;
+	uint32_t minSampleCount = std::numeric_limits<uint32_t>::max();
+	uint32_t convergedCount = 0;
+	for (uint32_t y = 0; y < film.GetHeight(); ++y)
+	{
+		for (uint32_t x = 0; x < film.GetWidth(); ++x)
+		{
+			sampleCount += film.getSampleCount(x, y);
+			minSampleCount = std::min(minSampleCount, film.getSampleCount(x, y));
+			convergedCount += film.isConverged(x, y);
+		}
+	}
+
+	const double pixelCount = static_cast<double>(film.GetWidth()) * static_cast<double>(film.GetHeight());
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(2) << scene.settings.sceneName << " samples per pixel: "
+		<< static_cast<double>(sampleCount) / pixelCount << " on average, " << minSampleCount << " to "
+		<< film.getMaxSampleCount();
+	if (scene.settings.imageSettings.adaptiveErrorThreshold > 0.f)
+		oss << ", " << 100.0 * static_cast<double>(convergedCount) / pixelCount << "% of the pixels converged";
+	oss << "\n";
+	std::cout << oss.str();
+}
+
+void Renderer::printSchedulingStats(const SchedulingStats& schedulingStats) const
+{
+	std::ostringstream oss;
+	oss << std::fixed << std::setprecision(2) << scene.settings.sceneName << " buckets: "
+		<< schedulingStats.bucketCount;
+	if (scene.settings.imageSettings.costAwareBuckets)
+	{
+		oss << ", cost pre-pass: " << schedulingStats.prepassSeconds << " seconds, subdivided: "
+			<< schedulingStats.subdividedCount;
+	}
+
+	oss << ", thread idle time:";
+	for (double busySeconds : schedulingStats.busySeconds)
+		oss << " " << std::max(0.0, schedulingStats.renderSeconds - busySeconds);
+	oss << " seconds\n";
+	std::cout << oss.str();
+}
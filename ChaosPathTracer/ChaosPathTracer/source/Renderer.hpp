@@ -4,9 +4,19 @@
 
 #include "PPMWriter.hpp"
 #include "Scene.hpp"
+#include "Film.hpp"
 #include "Image.hpp"
 #include "ThreadPool.hpp"
-
+#include "WavefrontRenderer.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <csignal>
+#include <chrono>
+#include <iostream>
+#include <limits>
+#include <mutex>
 #include <thread>
 #include <utility>
 
@@ -19,81 +29,334 @@ public:
 		: scene(scene)
 	{}
 
+	// Renders sample_count samples of every pixel in passes of pass_sample_count samples, see Film. Between the
+	// passes the image is written every pass_write_interval seconds, and Ctrl+C stops the render after the buckets
+	// in progress, with the samples rendered so far. With adaptive sampling, pixels whose error dropped below
+	// adaptive_error_threshold after a pass take no further samples. With a time_budget, passes are rendered until
+	// its deadline, which also stops the last pass between buckets
 	void renderImage()
 	{
-		Scene::Settings sceneSettings = scene.settings;
+		const auto renderStart = std::chrono::high_resolution_clock::now();
+		const Scene::ImageSettings& imageSettings = scene.settings.imageSettings;
+		Film film(imageSettings.width, imageSettings.height);
 
-		const uint32_t imageWidth = sceneSettings.imageSettings.width;
-		const uint32_t imageHeight = sceneSettings.imageSettings.height;
+		ThreadPool threadPool;
+		const uint32_t threadCount = static_cast<uint32_t>(std::max<size_t>(threadPool.GetThreadCount(), 1));
+		std::vector<Bucket> buckets = getBuckets(imageSettings.width, imageSettings.height, imageSettings.bucketSize);
 
-		Image image(imageWidth, imageHeight);
+		SchedulingStats schedulingStats;
+		schedulingStats.bucketCount = static_cast<uint32_t>(buckets.size());
+		schedulingStats.busySeconds.assign(threadCount, 0.0);
 
-		ThreadPool threadPool;
-		std::vector<std::future<void>> results;
-		uint32_t bucketSize = sceneSettings.imageSettings.bucketSize;
+		// Costs of the buckets not started yet, from every position of the schedule on
+		std::vector<double> remainingCosts;
+		if (imageSettings.costAwareBuckets)
+		{
+			auto prepassStart = std::chrono::high_resolution_clock::now();
+			estimateBucketCosts(threadPool, buckets);
+			schedulingStats.prepassSeconds = std::chrono::duration<double>(
+				std::chrono::high_resolution_clock::now() - prepassStart).count();
+
+			std::ranges::sort(buckets, [](const Bucket& a, const Bucket& b) { return a.cost > b.cost; });
+			remainingCosts.resize(buckets.size() + 1, 0.0);
+			for (size_t order = buckets.size(); order > 0; --order)
+				remainingCosts[order - 1] = remainingCosts[order] + buckets[order - 1].cost;
+		}
+
+		// A time budget renders passes until the deadline instead of up to sample_count samples
+		const bool timeBudget = imageSettings.timeBudget > 0.f;
+		const uint32_t maxSampleCount = timeBudget ? std::numeric_limits<uint32_t>::max() : imageSettings.sampleCount;
+		deadline = timeBudget
+			? renderStart + std::chrono::duration_cast<std::chrono::high_resolution_clock::duration>(
+				std::chrono::duration<float>(imageSettings.timeBudget))
+			: std::chrono::high_resolution_clock::time_point::max();
+
+		const bool progressive = imageSettings.passSampleCount > 0 && imageSettings.passSampleCount < maxSampleCount;
+		const bool adaptive = imageSettings.adaptiveErrorThreshold > 0.f;
+		uint32_t passSampleCount = imageSettings.sampleCount;
+		if (progressive)
+			passSampleCount = imageSettings.passSampleCount;
+		else if (adaptive)
+			passSampleCount = std::min(adaptivePassSampleCount, maxSampleCount);
+		else if (timeBudget)
+			passSampleCount = 1;
+		const uint32_t pixelCount = imageSettings.width * imageSettings.height;
+
+		stopRequested = false;
+		auto previousHandler = progressive || timeBudget ? std::signal(SIGINT, requestStop) : SIG_ERR;
+
+		uint32_t passCount = 0;
+		uint32_t renderedSampleCount = 0;
+		auto lastWrite = std::chrono::high_resolution_clock::now();
+		while (renderedSampleCount < maxSampleCount && !isStopped())
+		{
+			const uint32_t sampleCount = std::min(passSampleCount, maxSampleCount - renderedSampleCount);
+			renderPass(threadPool, film, buckets, remainingCosts, sampleCount, schedulingStats);
+			renderedSampleCount += sampleCount;
+			++passCount;
+
+			if (adaptive && film.updateConvergence(imageSettings.adaptiveErrorThreshold,
+			                                       imageSettings.adaptiveMinSampleCount) == pixelCount)
+				break;
+
+			const auto now = std::chrono::high_resolution_clock::now();
+			if (progressive && renderedSampleCount < maxSampleCount && !isStopped() &&
+				std::chrono::duration<double>(now - lastWrite).count() >= imageSettings.passWriteInterval)
+			{
+				writeToFile(film.develop(), scene.settings.sceneName + "_render");
+				std::cout << scene.settings.sceneName << " written after " << renderedSampleCount
+					<< " samples per pixel\n";
+				lastWrite = now;
+			}
+		}
+
+		if (previousHandler != SIG_ERR)
+			std::signal(SIGINT, previousHandler);
+		if (stopRequested)
+		{
+			std::cout << scene.settings.sceneName << " render stopped during pass " << passCount << "\n";
+		}
+		else if (timeBudget)
+		{
+			std::cout << scene.settings.sceneName << " time budget of " << imageSettings.timeBudget
+				<< " seconds used by " << passCount << " passes\n";
+		}
+
+		writeToFile(film.develop(), scene.settings.sceneName + "_render");
+		if (adaptive || timeBudget)
+		{
+			writeToFile(film.developSampleCounts(film.getMaxSampleCount()), scene.settings.sceneName + "_samples");
+			printSampleCountStats(film);
+		}
+		printOcclusionStats();
+		printSchedulingStats(schedulingStats);
+	}
+
+private:
+	struct Bucket
+	{
+		uint32_t startRow;
+		uint32_t endRow;
+		uint32_t startColumn;
+		uint32_t endColumn;
+		double cost = 0.0; // seconds of the cost pre-pass
+	};
+
+	struct SchedulingStats
+	{
+		uint32_t bucketCount = 0;
+		uint32_t subdividedCount = 0; // summed over the passes
+		double prepassSeconds = 0.0;
+		double renderSeconds = 0.0;
+		std::vector<double> busySeconds; // time every thread spent rendering
+	};
+
+	// Adds sampleCount samples of every pixel to the film. Every thread takes the next bucket of the schedule.
+	// A bucket costing more than the other threads have left to do is split into strips of rows, which the idle
+	// threads steal
+	void renderPass(ThreadPool& threadPool, Film& film, const std::vector<Bucket>& buckets,
+	                const std::vector<double>& remainingCosts, uint32_t sampleCount, SchedulingStats& schedulingStats)
+	{
+		const auto threadCount = static_cast<uint32_t>(schedulingStats.busySeconds.size());
+		std::atomic<uint32_t> nextBucket = 0;
+		std::atomic<uint32_t> subdividedCount = 0;
+		auto passStart = std::chrono::high_resolution_clock::now();
+		threadPool.ParallelFor(0, threadCount, 1, [&](uint32_t, uint32_t)
+		{
+			for (uint32_t order = nextBucket++; order < buckets.size() && !isStopped(); order = nextBucket++)
+			{
+				const Bucket& bucket = buckets[order];
+				if (film.isConverged(bucket.startRow, bucket.endRow, bucket.startColumn, bucket.endColumn))
+					continue;
+
+				const bool subdivide = !remainingCosts.empty() && threadCount > 1 &&
+					bucket.endRow - bucket.startRow > stripHeight &&
+					remainingCosts[order + 1] < bucket.cost * static_cast<double>(threadCount - 1);
+				if (!subdivide)
+				{
+					renderRegion(film, bucket, sampleCount, schedulingStats.busySeconds);
+					continue;
+				}
+
+				++subdividedCount;
+				const uint32_t stripCount = (bucket.endRow - bucket.startRow + stripHeight - 1) / stripHeight;
+				threadPool.ParallelFor(0, stripCount, 1, [&](uint32_t firstStrip, uint32_t lastStrip)
+				{
+					for (uint32_t stripIndex = firstStrip; stripIndex < lastStrip; ++stripIndex)
+					{
+						Bucket strip = bucket;
+						strip.startRow = bucket.startRow + stripIndex * stripHeight;
+						strip.endRow = std::min(strip.startRow + stripHeight, bucket.endRow);
+						renderRegion(film, strip, sampleCount, schedulingStats.busySeconds);
+					}
+				});
+			}
+		});
+
+		schedulingStats.subdividedCount += subdividedCount;
+		schedulingStats.renderSeconds += std::chrono::duration<double>(
+			std::chrono::high_resolution_clock::now() - passStart).count();
+	}
+
+	// Squares of bucketSize in raster order, clamped to the image
+	static std::vector<Bucket> getBuckets(uint32_t imageWidth, uint32_t imageHeight, uint32_t bucketSize)
+	{
+		std::vector<Bucket> buckets;
 		for (uint32_t startRow = 0; startRow < imageHeight; startRow += bucketSize)
 		{
-			uint32_t endRow = startRow + bucketSize;
 			for (uint32_t startColumn = 0; startColumn < imageWidth; startColumn += bucketSize)
 			{
-				uint32_t endColumn = startColumn + bucketSize;
-				results.emplace_back(threadPool.Enqueue([&, startRow, endRow, startColumn, endColumn]
+				buckets.push_back({startRow, std::min(startRow + bucketSize, imageHeight), startColumn,
+				                   std::min(startColumn + bucketSize, imageWidth)});
+			}
+		}
+		return buckets;
+	}
+
+	// Times one path of every costPrepassStride-th pixel in both directions, which is cheap next to the render
+	// and catches the buckets where the paths split on glass or bounce for long
+	void estimateBucketCosts(ThreadPool& threadPool, std::vector<Bucket>& buckets)
+	{
+		threadPool.ParallelFor(0, static_cast<uint32_t>(buckets.size()), 1, [&](uint32_t first, uint32_t last)
+		{
+			OccluderCache occluderCache(scene.lights.size());
+			Sampling::RandomSampler randomSampler;
+			for (uint32_t bucketIndex = first; bucketIndex < last; ++bucketIndex)
+			{
+				Bucket& bucket = buckets[bucketIndex];
+				auto start = std::chrono::high_resolution_clock::now();
+				for (uint32_t rowIdx = bucket.startRow; rowIdx < bucket.endRow; rowIdx += costPrepassStride)
 				{
-					for (uint32_t rowIdx = startRow; rowIdx < endRow; ++rowIdx)
+					for (uint32_t colIdx = bucket.startColumn; colIdx < bucket.endColumn; colIdx += costPrepassStride)
 					{
-						for (uint32_t colIdx = startColumn; colIdx < endColumn; ++colIdx)
-						{
-							Vector3 color{0.f};
+						Vector2 samplePosition = getSamplePosition(colIdx, rowIdx, randomSampler);
+						getPixel(samplePosition.x, samplePosition.y, occluderCache);
+					}
+				}
+				bucket.cost = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+			}
+		});
+	}
+
+	// Adds sampleCount samples of the pixels of the bucket to the film with the method of the image settings, and
+	// the time to the calling thread
+	void renderRegion(Film& film, const Bucket& bucket, uint32_t sampleCount, std::vector<double>& busySeconds)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
 
-							Sampling::RandomSampler randomSampler;
+		const auto& [startRow, endRow, startColumn, endColumn, cost] = bucket;
+		OccluderCache occluderCache(scene.lights.size());
+		if (scene.settings.imageSettings.wavefront)
+		{
+			WavefrontRenderer(scene, occluderCache).renderBucket(film, startRow, endRow, startColumn, endColumn,
+			                                                     sampleCount);
+		}
+		else
+		{
+			switch (scene.settings.imageSettings.rayPacketSize)
+			{
+			case 4:
+				renderBucketPackets<4>(film, startRow, endRow, startColumn, endColumn, sampleCount, occluderCache);
+				break;
+			case 8:
+				renderBucketPackets<8>(film, startRow, endRow, startColumn, endColumn, sampleCount, occluderCache);
+				break;
+			case 16:
+				renderBucketPackets<16>(film, startRow, endRow, startColumn, endColumn, sampleCount, occluderCache);
+				break;
+			default:
+				renderBucket(film, startRow, endRow, startColumn, endColumn, sampleCount, occluderCache);
+				break;
+			}
+		}
 
-							for (uint32_t sample = 0; sample < scene.settings.imageSettings.sampleCount; sample++)
-							{
-								float y = static_cast<float>(rowIdx) + randomSampler.next1D();
-								y /= static_cast<float>(imageHeight); // To NDC
-								y = 1.f - (2.f * y); // To screen space
+		{
+			std::lock_guard<std::mutex> lock(occlusionStatsMutex);
+			occlusionStats += occluderCache.stats;
+		}
 
-								float x = static_cast<float>(colIdx) + randomSampler.next1D();
-								x /= static_cast<float>(imageWidth); // To NDC
-								x = 2.f * x - 1.f; // To screen space
-								x *= static_cast<float>(imageWidth) / static_cast<float>(imageHeight);
-								// Consider aspect ratio
+		// Every thread only adds to its own entry
+		busySeconds[std::min<size_t>(ThreadPool::GetCurrentThreadIndex(), busySeconds.size() - 1)] +=
+			std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+	}
 
-								color += getPixel(x, y);
-							}
+	void renderBucket(Film& film, uint32_t startRow, uint32_t endRow, uint32_t startColumn, uint32_t endColumn,
+	                  uint32_t sampleCount, OccluderCache& occluderCache)
+	{
+		for (uint32_t rowIdx = startRow; rowIdx < endRow; ++rowIdx)
+		{
+			for (uint32_t colIdx = startColumn; colIdx < endColumn; ++colIdx)
+			{
+				if (film.isConverged(colIdx, rowIdx))
+					continue;
 
-							color /= static_cast<float>(scene.settings.imageSettings.sampleCount);
+				Sampling::RandomSampler randomSampler;
 
-							image.setPixel(colIdx, rowIdx, color.toRGB());
-						}
-					}
-				}));
+				for (uint32_t sample = 0; sample < sampleCount; sample++)
+				{
+					Vector2 samplePosition = getSamplePosition(colIdx, rowIdx, randomSampler);
+					film.addSample(colIdx, rowIdx, getPixel(samplePosition.x, samplePosition.y, occluderCache));
+				}
 			}
 		}
-
-		for (auto&& result : results)
-			result.get();
-
-		writeToFile(image, sceneSettings);
 	}
 
-private:
-	Vector3 getPixel(float x, float y)
+	// Primary rays of tiles of Width pixels are traced as one packet, the bounces are traced ray by ray
+	template <uint32_t Width>
+	void renderBucketPackets(Film& film, uint32_t startRow, uint32_t endRow, uint32_t startColumn,
+	                         uint32_t endColumn, uint32_t sampleCount, OccluderCache& occluderCache)
 	{
-		Vector3 origin = scene.camera.getPosition();
-		Vector3 forward = scene.camera.getLookDirection();
+		constexpr uint32_t tileWidth = Width == 4 ? 2 : 4;
+		constexpr uint32_t tileHeight = Width / tileWidth;
 
-		// Assume up vector is Y axis in camera space and right vector is X axis in camera space
-		Vector3 up = Normalize(scene.camera.transform * Vector3(0.f, 1.f, 0.f));
-		Vector3 right = Cross(forward, up);
+		Sampling::RandomSampler randomSampler;
+		for (uint32_t tileRow = startRow; tileRow < endRow; tileRow += tileHeight)
+		{
+			for (uint32_t tileColumn = startColumn; tileColumn < endColumn; tileColumn += tileWidth)
+			{
+				for (uint32_t sample = 0; sample < sampleCount; sample++)
+				{
+					// Lanes of the tile past the bucket edge and of converged pixels stay inactive
+					RayPacket<Width> packet;
+					for (uint32_t lane = 0; lane < Width; ++lane)
+					{
+						const uint32_t rowIdx = tileRow + lane / tileWidth;
+						const uint32_t colIdx = tileColumn + lane % tileWidth;
+						if (rowIdx >= endRow || colIdx >= endColumn || film.isConverged(colIdx, rowIdx))
+							continue;
 
-		// Calculate direction to pixel in camera space
-		Vector3 direction = Normalize(forward + right * x + up * y);
+						Vector2 samplePosition = getSamplePosition(colIdx, rowIdx, randomSampler);
+						packet.setRay(lane, scene.camera.generateRay(samplePosition.x, samplePosition.y));
+					}
 
-		Ray ray{origin, direction};
+					HitInfo hitInfos[Width];
+					scene.closestHit(packet, hitInfos);
+					for (uint32_t mask = packet.activeMask; mask != 0; mask &= mask - 1)
+					{
+						const auto lane = static_cast<uint32_t>(std::countr_zero(mask));
+						Ray ray = packet.getRay(lane);
+						film.addSample(tileColumn + lane % tileWidth, tileRow + lane / tileWidth,
+						               shadeHit(ray, hitInfos[lane], {}, randomSampler, occluderCache, 0));
+					}
+				}
+			}
+		}
+	}
+
+	// Jittered sample position in the pixel, in screen space with x scaled by the aspect ratio
+	Vector2 getSamplePosition(uint32_t colIdx, uint32_t rowIdx, Sampling::RandomSampler& randomSampler) const
+	{
+		const float y = static_cast<float>(rowIdx) + randomSampler.next1D();
+		const float x = static_cast<float>(colIdx) + randomSampler.next1D();
+		return Camera::toScreenSpace(x, y, scene.settings.imageSettings.width, scene.settings.imageSettings.height);
+	}
+
+	Vector3 getPixel(float x, float y, OccluderCache& occluderCache)
+	{
+		Ray ray = scene.camera.generateRay(x, y);
 
 		Sampling::RandomSampler randomSampler;
-		Vector3 L = traceRay(ray, {}, randomSampler, 0);
+		Vector3 L = traceRay(ray, {}, randomSampler, occluderCache, 0);
 
 		return L;
 	}
@@ -104,35 +367,44 @@ private:
 		float bsdfPdf = 1.f;
 	};
 
-	Vector3 traceRay(Ray& ray, PrevBounceInfo prevBounceInfo, Sampling::RandomSampler& rnd, uint32_t depth)
+	Vector3 traceRay(Ray& ray, PrevBounceInfo prevBounceInfo, Sampling::RandomSampler& rnd,
+	                 OccluderCache& occluderCache, uint32_t depth)
 	{
-		Vector3 L{0.f};
 		if (depth > scene.settings.imageSettings.traceDepth)
-			return L;
+			return Vector3{0.f};
 
 		HitInfo hitInfo = scene.closestHit(ray);
+		return shadeHit(ray, hitInfo, prevBounceInfo, rnd, occluderCache, depth);
+	}
+
+	// Radiance along the ray, which ended at hitInfo
+	Vector3 shadeHit(Ray& ray, const HitInfo& hitInfo, PrevBounceInfo prevBounceInfo, Sampling::RandomSampler& rnd,
+	                 OccluderCache& occluderCache, uint32_t depth)
+	{
+		Vector3 L{0.f};
 		if (hitInfo.hit)
 		{
 			const auto& material = scene.materials[hitInfo.materialIndex];
 			Vector3 normal = hitInfo.normal;
-			const auto& triangle = scene.triangles[hitInfo.triangleIndex];
 
 			if (material.smoothShading)
-				normal = triangle.getNormal(hitInfo.barycentrics);
+				normal = scene.getShadingNormal(hitInfo);
 
 			Vector3 offsetOrigin = OffsetRayOrigin(hitInfo.point, hitInfo.normal);
 			if (material.type == Material::Type::DIFFUSE || material.type == Material::Type::CONSTANT)
 			{
-				Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, triangle.getUVs(hitInfo.barycentrics));
+				Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, scene.getUVs(hitInfo));
 				Vector3 bsdf = albedo / PI;
 
 				// Iterate over explicit lights
-				for (const auto& light : scene.lights)
+				for (size_t lightIndex = 0; lightIndex < scene.lights.size(); ++lightIndex)
 				{
+					const auto& light = scene.lights[lightIndex];
 					Vector3 dirToLight = Normalize(light.position - offsetOrigin);
 					float distanceToLight = (light.position - offsetOrigin).magnitude();
 					Ray shadowRay{ offsetOrigin, dirToLight, distanceToLight};
-					if (!scene.anyHit(shadowRay))
+					auto& occluder = occluderCache.getPointLightOccluder(lightIndex);
+					if (!scene.anyHit(shadowRay, occluder, occluderCache.stats))
 					{
 						float attenuation = 1.0f / (distanceToLight * distanceToLight);
 						float nDotL = std::max(0.f, Dot(normal, dirToLight));
@@ -148,8 +420,8 @@ private:
 					EmissiveLightSample lightSample = lightSampleOpt.value();
 					Vector3 dirToLight = Normalize(lightSample.position - offsetOrigin);
 					float distanceToLight = (lightSample.position - offsetOrigin).magnitude();
-					Ray shadowRay{offsetOrigin, dirToLight, distanceToLight};
-					if (!scene.anyHit(shadowRay))
+					Ray shadowRay{offsetOrigin, dirToLight, distanceToLight * (1.f - SHADOW_RAY_EPSILON)};
+					if (!scene.anyHit(shadowRay, occluderCache.getEmissiveOccluder(), occluderCache.stats))
 					{
 						float nDotL = std::max(0.f, Dot(normal, dirToLight));
 
@@ -169,7 +441,7 @@ private:
 
 				float pdf = std::max(0.f, Dot(hitInfo.normal, randomDirection)) / PI;
 
-				Vector3 indirectLighting = traceRay(nextRay, { true, pdf }, rnd, depth + 1);
+				Vector3 indirectLighting = traceRay(nextRay, { true, pdf }, rnd, occluderCache, depth + 1);
 				float nDotL = std::max(0.f, Dot(normal, randomDirection));
 
 				if (pdf > 0.f)
@@ -180,8 +452,9 @@ private:
 				float misWeight = 1.f;
 				if (prevBounceInfo.lightSampledByNEE)
 				{
-					assert(triangle.emissiveIndex != -1);
-					float lightPdf = scene.emissiveSampler.evalPdf(triangle.emissiveIndex, ray.origin, hitInfo.point);
+					const int32_t emissiveIndex = scene.getEmissiveIndex(hitInfo);
+					assert(emissiveIndex != -1);
+					float lightPdf = scene.emissiveSampler.evalPdf(emissiveIndex, ray.origin, hitInfo.point);
 					misWeight = Sampling::powerHeuristic(prevBounceInfo.bsdfPdf, lightPdf);
 				}
 				L += material.emission * misWeight;
@@ -190,12 +463,12 @@ private:
 			{
 				Vector3 reflectionDir = Normalize(ray.directionN - normal * 2.f * Dot(normal, ray.directionN));
 				Ray reflectionRay{offsetOrigin, reflectionDir};
-				Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, triangle.getUVs(hitInfo.barycentrics));
-				L += albedo * traceRay(reflectionRay, {}, rnd, depth + 1);
+				Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, scene.getUVs(hitInfo));
+				L += albedo * traceRay(reflectionRay, {}, rnd, occluderCache, depth + 1);
 			}
 			else if (material.type == Material::Type::REFRACTIVE)
 			{
-				Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, triangle.getUVs(hitInfo.barycentrics));
+				Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, scene.getUVs(hitInfo));
 				float eta = material.ior;
 				Vector3 wi = -ray.directionN;
 				float cosThetaI = Dot(normal, wi);
@@ -214,7 +487,7 @@ private:
 					// Total internal reflection case
 					Vector3 reflectionDir = Normalize(ray.directionN - normal * 2.f * Dot(normal, ray.directionN));
 					Ray reflectionRay{offsetOrigin, reflectionDir};
-					L += albedo * traceRay(reflectionRay, {}, rnd, depth + 1);
+					L += albedo * traceRay(reflectionRay, {}, rnd, occluderCache, depth + 1);
 				}
 				else
 				{
@@ -225,7 +498,7 @@ private:
 						                                                 ? hitInfo.normal
 						                                                 : -hitInfo.normal);
 					Ray refractionRay{offsetOriginRefraction, wt};
-					Vector3 refractionL = albedo * traceRay(refractionRay, {}, rnd, depth + 1);
+					Vector3 refractionL = albedo * traceRay(refractionRay, {}, rnd, occluderCache, depth + 1);
 
 					Vector3 reflectionDir = Normalize(ray.directionN - normal * 2.f * Dot(normal, ray.directionN));
 					Vector3 offsetOriginReflection = OffsetRayOrigin(hitInfo.point,
@@ -233,7 +506,7 @@ private:
 						                                                 ? -hitInfo.normal
 						                                                 : hitInfo.normal);
 					Ray reflectionRay{offsetOriginReflection, reflectionDir};
-					Vector3 reflectionL = albedo * traceRay(reflectionRay, {}, rnd, depth + 1);
+					Vector3 reflectionL = albedo * traceRay(reflectionRay, {}, rnd, occluderCache, depth + 1);
 
 					float fresnel = 0.5f * std::powf(1.f + Dot(ray.directionN, normal), 5);
 
@@ -249,9 +522,36 @@ private:
 		return L;
 	}
 
-	static void writeToFile(const Image& image, const Scene::Settings& sceneSettings);
+	static void writeToFile(const Image& image, const std::string& filename);
+
+	void printSampleCountStats(const Film& film) const;
+
+	void printOcclusionStats() const;
+
+	void printSchedulingStats(const SchedulingStats& schedulingStats) const;
+
+	// SIGINT handler of progressive renders
+	static void requestStop(int)
+	{
+		stopRequested = true;
+	}
+
+	// No more buckets are started after Ctrl+C or past the deadline of the time budget
+	bool isStopped() const
+	{
+		return stopRequested || std::chrono::high_resolution_clock::now() >= deadline;
+	}
 
 	static constexpr uint32_t maxColorComponent = 255;
+	static constexpr uint32_t costPrepassStride = 4;
+	static constexpr uint32_t adaptivePassSampleCount = 4; // samples between the convergence tests without passes
+	static constexpr uint32_t stripHeight = 4; // rows of the strips of a subdivided bucket, fits the packet tiles
 
 	Scene& scene;
+
+	std::mutex occlusionStatsMutex;
+	OccluderCache::Stats occlusionStats; // summed over the buckets of the render
+
+	inline static std::atomic<bool> stopRequested = false;
+	std::chrono::high_resolution_clock::time_point deadline = std::chrono::high_resolution_clock::time_point::max();
 };
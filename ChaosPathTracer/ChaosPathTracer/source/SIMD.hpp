@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+
+// Thin wrappers over the SSE/AVX registers. Float8 falls back to a pair of SSE registers when the
+// compiler is not allowed to emit AVX instructions, Float16 is always a pair of Float8.
+// min/max follow the SSE semantics and return the second operand when either one is NaN.
+namespace SIMD
+{
+	struct Float4
+	{
+		__m128 v;
+
+		static Float4 load(const float* p) { return {_mm_load_ps(p)}; }
+		static Float4 broadcast(float f) { return {_mm_set1_ps(f)}; }
+
+		void store(float* p) const { _mm_store_ps(p, v); }
+	};
+
+	inline Float4 operator +(const Float4& a, const Float4& b) { return {_mm_add_ps(a.v, b.v)}; }
+	inline Float4 operator -(const Float4& a, const Float4& b) { return {_mm_sub_ps(a.v, b.v)}; }
+	inline Float4 operator *(const Float4& a, const Float4& b) { return {_mm_mul_ps(a.v, b.v)}; }
+	inline Float4 operator /(const Float4& a, const Float4& b) { return {_mm_div_ps(a.v, b.v)}; }
+	inline Float4 min(const Float4& a, const Float4& b) { return {_mm_min_ps(a.v, b.v)}; }
+	inline Float4 max(const Float4& a, const Float4& b) { return {_mm_max_ps(a.v, b.v)}; }
+
+	// Lane bit mask of a < b
+	inline uint32_t lessMask(const Float4& a, const Float4& b)
+	{
+		return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmplt_ps(a.v, b.v)));
+	}
+
+#if defined(__AVX__)
+	struct Float8
+	{
+		__m256 v;
+
+		static Float8 load(const float* p) { return {_mm256_load_ps(p)}; }
+		static Float8 broadcast(float f) { return {_mm256_set1_ps(f)}; }
+
+		void store(float* p) const { _mm256_store_ps(p, v); }
+	};
+
+	inline Float8 operator +(const Float8& a, const Float8& b) { return {_mm256_add_ps(a.v, b.v)}; }
+	inline Float8 operator -(const Float8& a, const Float8& b) { return {_mm256_sub_ps(a.v, b.v)}; }
+	inline Float8 operator *(const Float8& a, const Float8& b) { return {_mm256_mul_ps(a.v, b.v)}; }
+	inline Float8 operator /(const Float8& a, const Float8& b) { return {_mm256_div_ps(a.v, b.v)}; }
+	inline Float8 min(const Float8& a, const Float8& b) { return {_mm256_min_ps(a.v, b.v)}; }
+	inline Float8 max(const Float8& a, const Float8& b) { return {_mm256_max_ps(a.v, b.v)}; }
+
+	inline uint32_t lessMask(const Float8& a, const Float8& b)
+	{
+		return static_cast<uint32_t>(_mm256_movemask_ps(_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)));
+	}
+#else
+	struct Float8
+	{
+		Float4 lo;
+		Float4 hi;
+
+		static Float8 load(const float* p) { return {Float4::load(p), Float4::load(p + 4)}; }
+		static Float8 broadcast(float f) { return {Float4::broadcast(f), Float4::broadcast(f)}; }
+
+		void store(float* p) const
+		{
+			lo.store(p);
+			hi.store(p + 4);
+		}
+	};
+
+	inline Float8 operator +(const Float8& a, const Float8& b) { return {a.lo + b.lo, a.hi + b.hi}; }
+	inline Float8 operator -(const Float8& a, const Float8& b) { return {a.lo - b.lo, a.hi - b.hi}; }
+	inline Float8 operator *(const Float8& a, const Float8& b) { return {a.lo * b.lo, a.hi * b.hi}; }
+	inline Float8 operator /(const Float8& a, const Float8& b) { return {a.lo / b.lo, a.hi / b.hi}; }
+	inline Float8 min(const Float8& a, const Float8& b) { return {min(a.lo, b.lo), min(a.hi, b.hi)}; }
+	inline Float8 max(const Float8& a, const Float8& b) { return {max(a.lo, b.lo), max(a.hi, b.hi)}; }
+
+	inline uint32_t lessMask(const Float8& a, const Float8& b)
+	{
+		return lessMask(a.lo, b.lo) | (lessMask(a.hi, b.hi) << 4);
+	}
+#endif
+
+	struct Float16
+	{
+		Float8 lo;
+		Float8 hi;
+
+		static Float16 load(const float* p) { return {Float8::load(p), Float8::load(p + 8)}; }
+		static Float16 broadcast(float f) { return {Float8::broadcast(f), Float8::broadcast(f)}; }
+
+		void store(float* p) const
+		{
+			lo.store(p);
+			hi.store(p + 8);
+		}
+	};
+
+	inline Float16 operator +(const Float16& a, const Float16& b) { return {a.lo + b.lo, a.hi + b.hi}; }
+	inline Float16 operator -(const Float16& a, const Float16& b) { return {a.lo - b.lo, a.hi - b.hi}; }
+	inline Float16 operator *(const Float16& a, const Float16& b) { return {a.lo * b.lo, a.hi * b.hi}; }
+	inline Float16 operator /(const Float16& a, const Float16& b) { return {a.lo / b.lo, a.hi / b.hi}; }
+	inline Float16 min(const Float16& a, const Float16& b) { return {min(a.lo, b.lo), min(a.hi, b.hi)}; }
+	inline Float16 max(const Float16& a, const Float16& b) { return {max(a.lo, b.lo), max(a.hi, b.hi)}; }
+
+	inline uint32_t lessMask(const Float16& a, const Float16& b)
+	{
+		return lessMask(a.lo, b.lo) | (lessMask(a.hi, b.hi) << 8);
+	}
+
+	template <uint32_t Width>
+	struct FloatN;
+
+	template <>
+	struct FloatN<4>
+	{
+		using Type = Float4;
+	};
+
+	template <>
+	struct FloatN<8>
+	{
+		using Type = Float8;
+	};
+
+	template <>
+	struct FloatN<16>
+	{
+		using Type = Float16;
+	};
+}
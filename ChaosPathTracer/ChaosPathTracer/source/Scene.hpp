@@ -2,16 +2,23 @@
 
 #include "Camera.hpp"
 #include "BVH.hpp"
+#include "BVHCache.hpp"
 #include "Material.hpp"
 #include "SceneParser.hpp"
 #include "Light.hpp"
 #include "EmissiveSampler.hpp"
+#include "Instance.hpp"
+#include "OccluderCache.hpp"
+#include "Sampling.hpp"
+#include "ThreadPool.hpp"
 
 #include <vector>
 #include <algorithm>
 #include <map>
 #include <optional>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 
 class Scene final
 {
@@ -22,14 +29,21 @@ public:
         SceneParser sceneParser(*this);
         sceneParser.parseSceneFile(fileName);
         std::cout << fileName << " parsed.\n";
-        bvh = BVH(triangles);
-        std::cout << fileName << " BVH built.\n";
+        if (settings.compactVertexAttributes)
+            compactVertexAttributes();
+        std::cout << fileName << (buildBVH() ? " BVH loaded from cache.\n" : " BVH built.\n");
     }
 
     Scene(Scene&& other) noexcept
         : camera(std::move(other.camera)),
+        vertices(std::move(other.vertices)),
         triangles(std::move(other.triangles)),
+        intersections(std::move(other.intersections)),
+        triangleOrder(std::move(other.triangleOrder)),
         bvh(std::move(other.bvh)),
+        meshes(std::move(other.meshes)),
+        instances(std::move(other.instances)),
+        instanceBVH(std::move(other.instanceBVH)),
         materials(std::move(other.materials)),
         textures(std::move(other.textures)),
         lights(std::move(other.lights)),
@@ -43,8 +57,14 @@ public:
         if (this != &other)
         {
             camera = std::move(other.camera);
+            vertices = std::move(other.vertices);
             triangles = std::move(other.triangles);
+            intersections = std::move(other.intersections);
+            triangleOrder = std::move(other.triangleOrder);
             bvh = std::move(other.bvh);
+            meshes = std::move(other.meshes);
+            instances = std::move(other.instances);
+            instanceBVH = std::move(other.instanceBVH);
             materials = std::move(other.materials);
             textures = std::move(other.textures);
             lights = std::move(other.lights);
@@ -57,6 +77,48 @@ public:
     Scene(const Scene&) = delete;
     Scene& operator=(const Scene&) = delete;
 
+    // Loads the next frame of an animation. When the frame only moves the triangles of this one, the BVHs
+    // are refitted in a linear pass, and rebuilt only once refitting degraded them past the threshold
+    void loadFrame(const std::string& fileName)
+    {
+        Scene frame;
+        SceneParser sceneParser(frame);
+        sceneParser.parseSceneFile(fileName);
+        std::cout << fileName << " parsed.\n";
+        if (frame.settings.compactVertexAttributes)
+            frame.compactVertexAttributes();
+
+        bool refitted = frame.settings.bvhSettings == settings.bvhSettings && frame.meshes.size() == meshes.size() &&
+            refitGeometry(frame.triangles, frame.vertices, triangles, vertices, triangleOrder, bvh);
+        for (uint32_t meshIndex = 0; refitted && meshIndex < meshes.size(); ++meshIndex)
+        {
+            const Mesh& frameMesh = frame.meshes[meshIndex];
+            Mesh& mesh = meshes[meshIndex];
+            refitted = refitGeometry(frameMesh.triangles, frameMesh.vertices, mesh.triangles, mesh.vertices,
+                                     mesh.triangleOrder, mesh.bvh);
+        }
+
+        if (!refitted)
+        {
+            *this = std::move(frame);
+            std::cout << fileName << (buildBVH() ? " BVH loaded from cache.\n" : " BVH built.\n");
+            return;
+        }
+
+        // Everything but the geometry comes from the new frame, the top-level BVH is cheap to rebuild
+        camera = std::move(frame.camera);
+        instances = std::move(frame.instances);
+        materials = std::move(frame.materials);
+        textures = std::move(frame.textures);
+        lights = std::move(frame.lights);
+        emissiveSampler = std::move(frame.emissiveSampler);
+        settings = std::move(frame.settings);
+        updateIntersections();
+        if (!instances.empty())
+            buildInstanceBVH();
+        std::cout << fileName << " BVH refitted.\n";
+    }
+
     struct ImageSettings
     {
         uint32_t width;
@@ -64,6 +126,14 @@ public:
         uint32_t bucketSize = 24;
         uint32_t sampleCount = 16;
         uint32_t traceDepth = 5;
+        uint32_t rayPacketSize = 0; // primary rays are traced in packets of 4, 8 or 16, one by one otherwise
+        bool wavefront = false; // paths are traced in stages over queues of a whole bucket, see WavefrontRenderer
+        bool costAwareBuckets = false; // buckets are rendered by their cost from a pre-pass, see Renderer::renderImage
+        uint32_t passSampleCount = 0; // samples per pixel of every progressive pass, all of them in one pass when 0
+        float passWriteInterval = 0.f; // seconds between the images written after the progressive passes
+        float adaptiveErrorThreshold = 0.f; // relative error at which pixels stop taking samples, off when 0
+        uint32_t adaptiveMinSampleCount = 16; // samples of a pixel before its error is trusted
+        float timeBudget = 0.f; // seconds of rendering passes until the image is written, off when 0
     };
 
     struct Settings
@@ -71,25 +141,405 @@ public:
         std::string sceneName;
         Vector3 backgroundColor;
         ImageSettings imageSettings;
+        BVH::BuildSettings bvhSettings;
+        bool compactVertexAttributes = false; // normals and UVs are quantized, see VertexBuffer::compactAttributes
     };
 
 
+    // The scene triangles are tested first, so that their hit already culls the instances behind it
     HitInfo closestHit(Ray& ray) const
     {
-        return bvh.closestHit(triangles, materials, ray);
+        HitInfo hitInfo = bvh.closestHit(intersections, materials, ray);
+        if (!instances.empty())
+            hitInfo = closestInstanceHit(ray, hitInfo);
+
+        completeHit(ray, hitInfo);
+        return hitInfo;
+    }
+
+    // Closest hits of a packet of coherent rays, see BVH::closestHit. Instances are tested ray by ray
+    template <uint32_t Width>
+    void closestHit(RayPacket<Width>& packet, HitInfo* hitInfos) const
+    {
+        bvh.closestHit(intersections, materials, packet, hitInfos);
+        for (uint32_t mask = packet.activeMask; mask != 0; mask &= mask - 1)
+        {
+            const auto lane = static_cast<uint32_t>(std::countr_zero(mask));
+            Ray ray = packet.getRay(lane);
+            if (!instances.empty())
+                hitInfos[lane] = closestInstanceHit(ray, hitInfos[lane]);
+
+            completeHit(ray, hitInfos[lane]);
+        }
     }
 
     bool anyHit(Ray& ray) const
     {
-        return bvh.anyHit(triangles, materials, ray);
+        if (bvh.anyHit(intersections, materials, ray))
+            return true;
+
+        return !instances.empty() && instanceBVH.traverse(ray, InstanceAnyHitPolicy{*this, ray}).hit;
+    }
+
+    // Shadow ray towards a light whose last blocking triangle is cached in occluder. The cached triangle is
+    // tested first, and a triangle found by the traversal replaces it
+    bool anyHit(Ray& ray, OccluderCache::Occluder& occluder, OccluderCache::Stats& stats) const
+    {
+        ++stats.queryCount;
+        if (occluder.isValid() && occludes(occluder, ray))
+        {
+            ++stats.occludedCount;
+            ++stats.cacheHitCount;
+            return true;
+        }
+
+        HitInfo hitInfo = bvh.occlusionHit(intersections, materials, ray);
+        if (!hitInfo.hit && !instances.empty())
+            hitInfo = instanceBVH.traverse(ray, InstanceAnyHitPolicy{*this, ray});
+        if (!hitInfo.hit)
+            return false;
+
+        occluder = {hitInfo.instanceIndex, hitInfo.triangleIndex};
+        ++stats.occludedCount;
+        return true;
+    }
+
+    const Triangle& getTriangle(const HitInfo& hitInfo) const
+    {
+        if (hitInfo.instanceIndex < 0)
+            return triangles[hitInfo.triangleIndex];
+
+        return meshes[instances[hitInfo.instanceIndex].meshIndex].triangles[hitInfo.triangleIndex];
+    }
+
+    // Vertex buffer indexed by the triangle of the hit
+    const VertexBuffer& getVertices(const HitInfo& hitInfo) const
+    {
+        if (hitInfo.instanceIndex < 0)
+            return vertices;
+
+        return meshes[instances[hitInfo.instanceIndex].meshIndex].vertices;
+    }
+
+    // Interpolated vertex normal in world space
+    Vector3 getShadingNormal(const HitInfo& hitInfo) const
+    {
+        Vector3 normal = getTriangle(hitInfo).getNormal(getVertices(hitInfo), hitInfo.barycentrics);
+        if (hitInfo.instanceIndex < 0)
+            return normal;
+
+        return instances[hitInfo.instanceIndex].normalToWorld(normal);
+    }
+
+    Vector2 getUVs(const HitInfo& hitInfo) const
+    {
+        return getTriangle(hitInfo).getUVs(getVertices(hitInfo), hitInfo.barycentrics);
+    }
+
+    // Index into emissiveSampler, instances of an emissive mesh each own a block of world space triangles
+    int32_t getEmissiveIndex(const HitInfo& hitInfo) const
+    {
+        const int32_t emissiveIndex = getTriangle(hitInfo).emissiveIndex;
+        if (hitInfo.instanceIndex < 0 || emissiveIndex < 0)
+            return emissiveIndex;
+
+        return instances[hitInfo.instanceIndex].emissiveOffset + emissiveIndex;
     }
 
     Camera camera;
+    VertexBuffer vertices; // shared by the triangles of all objects that are not instanced
     std::vector<Triangle> triangles;
+    IntersectionBuffer intersections; // hot copy of the triangles for the BVH
+    std::vector<uint32_t> triangleOrder; // source index of every triangle, see BVH
     BVH bvh;
+    std::vector<Mesh> meshes;
+    std::vector<Instance> instances;
+    BVH instanceBVH;
     std::vector<Material> materials;
     std::map<std::string, std::shared_ptr<const Texture>> textures;
     std::vector<Light> lights;
     EmissiveSampler emissiveSampler;
     Settings settings;
+
+private:
+    Scene() = default;
+
+    // Instances hit closer than the given hit of the scene triangles, ray.maxT has to be at that hit
+    HitInfo closestInstanceHit(Ray& ray, const HitInfo& hitInfo) const
+    {
+        HitInfo instanceHitInfo = instanceBVH.traverse(ray, InstanceClosestHitPolicy{*this, ray});
+        return instanceHitInfo.hit ? instanceHitInfo : hitInfo;
+    }
+
+    // The traversals only record the distance, triangle and barycentrics of every closer hit, the point, the
+    // world space geometric normal and the material of the final one are derived here
+    void completeHit(const Ray& ray, HitInfo& hitInfo) const
+    {
+        if (!hitInfo.hit)
+            return;
+
+        hitInfo.point = ray(hitInfo.t);
+        if (hitInfo.instanceIndex < 0)
+        {
+            const IntersectionTriangle& triangle = intersections.triangles[hitInfo.triangleIndex];
+            hitInfo.normal = triangle.getNormal();
+            hitInfo.materialIndex = triangle.materialIndex;
+            return;
+        }
+
+        // Instance distances are measured along the world space ray, only the normal is in object space
+        const Instance& instance = instances[hitInfo.instanceIndex];
+        const Mesh& mesh = meshes[instance.meshIndex];
+        const IntersectionTriangle& triangle = mesh.intersections.triangles[hitInfo.triangleIndex];
+        hitInfo.normal = instance.normalToWorld(triangle.getNormal());
+        hitInfo.materialIndex = triangle.materialIndex;
+    }
+
+    bool occludes(const OccluderCache::Occluder& occluder, const Ray& ray) const
+    {
+        if (occluder.instanceIndex < 0)
+        {
+            const IntersectionTriangle& triangle = intersections.triangles[occluder.triangleIndex];
+            return triangle.intersects(ray, materials[triangle.materialIndex].cullBackFace());
+        }
+
+        const Instance& instance = instances[occluder.instanceIndex];
+        const Mesh& mesh = meshes[instance.meshIndex];
+        const IntersectionTriangle& triangle = mesh.intersections.triangles[occluder.triangleIndex];
+        return triangle.intersects(instance.toObject(ray), materials[triangle.materialIndex].cullBackFace());
+    }
+
+    // Top-level leaf policies, the ray is moved into the object space of every instance in the leaf
+    struct InstanceClosestHitPolicy
+    {
+        const Scene& scene;
+        Ray& ray;
+
+        bool operator()(HitInfo& hitInfo, uint32_t instancesStart, uint32_t instancesEnd) const
+        {
+            for (uint32_t instanceIndex = instancesStart; instanceIndex < instancesEnd; ++instanceIndex)
+            {
+                const Instance& instance = scene.instances[instanceIndex];
+                const Mesh& mesh = scene.meshes[instance.meshIndex];
+
+                Ray objectRay = instance.toObject(ray);
+                HitInfo currHitInfo = mesh.bvh.closestHit(mesh.intersections, scene.materials, objectRay);
+                if (currHitInfo.hit && currHitInfo.t < hitInfo.t)
+                {
+                    currHitInfo.instanceIndex = static_cast<int32_t>(instanceIndex);
+                    hitInfo = currHitInfo;
+                    ray.maxT = hitInfo.t;
+                }
+            }
+            return false;
+        }
+    };
+
+    struct InstanceAnyHitPolicy
+    {
+        const Scene& scene;
+        const Ray& ray;
+
+        bool operator()(HitInfo& hitInfo, uint32_t instancesStart, uint32_t instancesEnd) const
+        {
+            for (uint32_t instanceIndex = instancesStart; instanceIndex < instancesEnd; ++instanceIndex)
+            {
+                const Instance& instance = scene.instances[instanceIndex];
+                const Mesh& mesh = scene.meshes[instance.meshIndex];
+
+                Ray objectRay = instance.toObject(ray);
+                HitInfo currHitInfo = mesh.bvh.occlusionHit(mesh.intersections, scene.materials, objectRay);
+                if (currHitInfo.hit)
+                {
+                    currHitInfo.instanceIndex = static_cast<int32_t>(instanceIndex);
+                    hitInfo = currHitInfo;
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    // Bottom-level BVHs are built once per mesh and shared by its instances. Returns true when the scene and
+    // mesh BVHs were loaded from the cache instead
+    bool buildBVH()
+    {
+        const bool profiledNodeOrder = settings.bvhSettings.nodeOrder == BVH::NodeOrder::AccessFrequency &&
+            settings.bvhSettings.nodeOrderProfileSampleCount > 0;
+
+        std::optional<BVHCache> bvhCache;
+        if (settings.bvhSettings.useCache)
+        {
+            std::optional<BVHCache::ProfileView> profileView;
+            if (profiledNodeOrder)
+                profileView = BVHCache::ProfileView{camera.transform, settings.imageSettings.width,
+                                                    settings.imageSettings.height, settings.imageSettings.traceDepth};
+
+            std::vector<BVHCache::Entry> cacheEntries{{triangles, vertices, triangleOrder, bvh, profileView}};
+            for (auto& mesh : meshes)
+                cacheEntries.push_back({mesh.triangles, mesh.vertices, mesh.triangleOrder, mesh.bvh});
+            bvhCache.emplace(settings.sceneName + ".bvhcache", settings.bvhSettings, std::move(cacheEntries));
+        }
+
+        const bool loadedFromCache = bvhCache.has_value() && bvhCache->load();
+        if (!loadedFromCache)
+        {
+            bvh = BVH(triangles, vertices, settings.bvhSettings, &triangleOrder);
+            for (auto& mesh : meshes)
+                mesh.bvh = BVH(mesh.triangles, mesh.vertices, settings.bvhSettings, &mesh.triangleOrder);
+
+            updateIntersections();
+            if (profiledNodeOrder)
+                trainNodeOrder();
+
+            if (bvhCache.has_value())
+                bvhCache->save();
+        }
+        else
+            updateIntersections();
+
+        if (!instances.empty())
+            buildInstanceBVH();
+        return loadedFromCache;
+    }
+
+    // Profiling render for the access frequency node order of the scene BVH: camera rays and their diffuse
+    // bounces up to the trace depth count how often they enter every node. The mesh BVHs keep the order
+    // estimated from the surface areas
+    void trainNodeOrder()
+    {
+        const ImageSettings& imageSettings = settings.imageSettings;
+
+        ThreadPool threadPool;
+        const auto taskCount = static_cast<uint32_t>(std::max<size_t>(threadPool.GetThreadCount(), 1));
+        std::vector<std::vector<uint32_t>> taskAccessCounts(taskCount);
+        std::vector<std::future<void>> results;
+        for (uint32_t taskIndex = 0; taskIndex < taskCount; ++taskIndex)
+        {
+            results.emplace_back(threadPool.Enqueue([&, taskIndex]
+            {
+                Sampling::RandomSampler randomSampler;
+                for (uint32_t rowIdx = taskIndex; rowIdx < imageSettings.height; rowIdx += taskCount)
+                {
+                    for (uint32_t colIdx = 0; colIdx < imageSettings.width; ++colIdx)
+                    {
+                        for (uint32_t sample = 0; sample < settings.bvhSettings.nodeOrderProfileSampleCount; ++sample)
+                        {
+                            const float y = static_cast<float>(rowIdx) + randomSampler.next1D();
+                            const float x = static_cast<float>(colIdx) + randomSampler.next1D();
+                            const Vector2 samplePosition = Camera::toScreenSpace(x, y, imageSettings.width,
+                                                                                 imageSettings.height);
+
+                            Ray ray = camera.generateRay(samplePosition.x, samplePosition.y);
+                            for (uint32_t depth = 0; depth <= imageSettings.traceDepth; ++depth)
+                            {
+                                HitInfo hitInfo = bvh.traverse(ray,
+                                    BVH::ClosestHitPolicy{intersections.triangles, materials, ray},
+                                    taskAccessCounts[taskIndex]);
+                                if (!hitInfo.hit)
+                                    break;
+
+                                completeHit(ray, hitInfo);
+
+                                Vector3 normal = Dot(hitInfo.normal, ray.directionN) > 0.f ? -hitInfo.normal : hitInfo.normal;
+                                Vector3 direction = randomInHemisphereCosine(normal, randomSampler.next2D());
+                                ray = Ray{OffsetRayOrigin(hitInfo.point, normal), direction};
+                            }
+                        }
+                    }
+                }
+            }));
+        }
+
+        for (auto&& result : results)
+            result.get();
+
+        std::vector<uint32_t> nodeAccessCounts;
+        for (const auto& accessCounts : taskAccessCounts)
+        {
+            nodeAccessCounts.resize(std::max(nodeAccessCounts.size(), accessCounts.size()));
+            for (size_t nodeIndex = 0; nodeIndex < accessCounts.size(); ++nodeIndex)
+                nodeAccessCounts[nodeIndex] += accessCounts[nodeIndex];
+        }
+        bvh.reorderNodes(&nodeAccessCounts);
+    }
+
+    // Quantizes the vertex attributes of the scene and of all meshes and reports the memory saved
+    void compactVertexAttributes()
+    {
+        size_t fullSize = vertices.getMemorySize();
+        vertices.compactAttributes();
+        size_t compactSize = vertices.getMemorySize();
+        for (auto& mesh : meshes)
+        {
+            fullSize += mesh.vertices.getMemorySize();
+            mesh.vertices.compactAttributes();
+            compactSize += mesh.vertices.getMemorySize();
+        }
+
+        const auto toMB = [](size_t size)
+        {
+            return static_cast<double>(size) / (1024. * 1024.);
+        };
+        std::ostringstream oss;
+        oss << std::fixed << std::setprecision(2) << "Vertex attributes compacted from " << toMB(fullSize) << " MB to "
+            << toMB(compactSize) << " MB, saved " << toMB(fullSize - compactSize) << " MB.\n";
+        std::cout << oss.str();
+    }
+
+    // Copies the triangles in their BVH order into the intersection records and triangle packs the traversals test
+    void updateIntersections()
+    {
+        intersections.build(triangles, vertices, materials, bvh.getSettings().leafPackWidth);
+        for (auto& mesh : meshes)
+            mesh.intersections.build(mesh.triangles, mesh.vertices, materials, mesh.bvh.getSettings().leafPackWidth);
+    }
+
+    // The top-level BVH is built over the world bounds of the instances
+    void buildInstanceBVH()
+    {
+        for (auto& mesh : meshes)
+        {
+            const Range range{0, static_cast<uint32_t>(mesh.triangles.size())};
+            mesh.boundingBox = AABB(mesh.triangles, mesh.vertices, range);
+        }
+
+        std::vector<AABB> instanceBounds;
+        instanceBounds.reserve(instances.size());
+        for (const auto& instance : instances)
+            instanceBounds.push_back(instance.worldBounds(meshes[instance.meshIndex].boundingBox));
+
+        std::vector<uint32_t> instanceOrder;
+        instanceBVH = BVH(instanceBounds, settings.bvhSettings, instanceOrder);
+
+        std::vector<Instance> orderedInstances;
+        orderedInstances.reserve(instances.size());
+        for (uint32_t instanceIndex : instanceOrder)
+            orderedInstances.push_back(instances[instanceIndex]);
+        instances = std::move(orderedInstances);
+    }
+
+    // Takes over the vertices of a new frame and refits the BVH over them. Returns false when the frame has
+    // different triangles or the refitted BVH got too slow, the BVH then has to be rebuilt
+    static bool refitGeometry(const std::vector<Triangle>& frameTriangles, const VertexBuffer& frameVertices,
+                              const std::vector<Triangle>& triangles, VertexBuffer& vertices,
+                              const std::vector<uint32_t>& triangleOrder, BVH& bvh)
+    {
+        const uint32_t sourceTriangleCount = triangleOrder.empty()
+            ? 0
+            : *std::max_element(triangleOrder.begin(), triangleOrder.end()) + 1;
+        if (frameTriangles.size() != sourceTriangleCount ||
+            frameVertices.positions.size() != vertices.positions.size())
+            return false;
+
+        // The triangles are in BVH order, the frame has to index the same vertices with the same materials
+        for (uint32_t triangleIndex = 0; triangleIndex < triangles.size(); ++triangleIndex)
+        {
+            if (!(frameTriangles[triangleOrder[triangleIndex]] == triangles[triangleIndex]))
+                return false;
+        }
+
+        vertices = frameVertices;
+        return bvh.refit(triangles, vertices);
+    }
 };
\ No newline at end of file
@@ -120,6 +120,13 @@ void SceneParser::parseSceneFile(const std::string& fileName) const
 		assert(!bgColorVal.IsNull() && bgColorVal.IsArray());
 		scene.settings.backgroundColor = loadVector(bgColorVal.GetArray());
 
+		if (settingsVal.HasMember(kCompactVertexAttributesStr.c_str()))
+		{
+			const Value& compactVal = settingsVal.FindMember(kCompactVertexAttributesStr.c_str())->value;
+			assert(!compactVal.IsNull() && compactVal.IsBool());
+			scene.settings.compactVertexAttributes = compactVal.GetBool();
+		}
+
 		const Value& imageSettingsVal = settingsVal.FindMember(kImageSettingsStr.c_str())->value;
 		if (!imageSettingsVal.IsNull() && imageSettingsVal.IsObject())
 		{
@@ -150,6 +157,203 @@ void SceneParser::parseSceneFile(const std::string& fileName) const
 				assert(!traceDepthVal.IsNull() && traceDepthVal.IsInt());
 				scene.settings.imageSettings.traceDepth = traceDepthVal.GetInt();
 			}
+
+			if (imageSettingsVal.HasMember(kRayPacketSizeStr.c_str()))
+			{
+				const Value& rayPacketSizeVal = imageSettingsVal.FindMember(kRayPacketSizeStr.c_str())->value;
+				assert(!rayPacketSizeVal.IsNull() && rayPacketSizeVal.IsInt());
+				scene.settings.imageSettings.rayPacketSize = rayPacketSizeVal.GetInt();
+			}
+
+			if (imageSettingsVal.HasMember(kWavefrontStr.c_str()))
+			{
+				const Value& wavefrontVal = imageSettingsVal.FindMember(kWavefrontStr.c_str())->value;
+				assert(!wavefrontVal.IsNull() && wavefrontVal.IsBool());
+				scene.settings.imageSettings.wavefront = wavefrontVal.GetBool();
+			}
+
+			if (imageSettingsVal.HasMember(kCostAwareBucketsStr.c_str()))
+			{
+				const Value& costAwareVal = imageSettingsVal.FindMember(kCostAwareBucketsStr.c_str())->value;
+				assert(!costAwareVal.IsNull() && costAwareVal.IsBool());
+				scene.settings.imageSettings.costAwareBuckets = costAwareVal.GetBool();
+			}
+
+			if (imageSettingsVal.HasMember(kPassSampleCountStr.c_str()))
+			{
+				const Value& passSampleCountVal = imageSettingsVal.FindMember(kPassSampleCountStr.c_str())->value;
+				assert(!passSampleCountVal.IsNull() && passSampleCountVal.IsInt());
+				scene.settings.imageSettings.passSampleCount = passSampleCountVal.GetInt();
+			}
+
+			if (imageSettingsVal.HasMember(kPassWriteIntervalStr.c_str()))
+			{
+				const Value& passWriteIntervalVal = imageSettingsVal.FindMember(kPassWriteIntervalStr.c_str())->value;
+				assert(!passWriteIntervalVal.IsNull() && passWriteIntervalVal.IsNumber());
+				scene.settings.imageSettings.passWriteInterval = passWriteIntervalVal.GetFloat();
+			}
+
+			if (imageSettingsVal.HasMember(kAdaptiveErrorThresholdStr.c_str()))
+			{
+				const Value& errorThresholdVal = imageSettingsVal.FindMember(kAdaptiveErrorThresholdStr.c_str())->value;
+				assert(!errorThresholdVal.IsNull() && errorThresholdVal.IsNumber());
+				scene.settings.imageSettings.adaptiveErrorThreshold = errorThresholdVal.GetFloat();
+			}
+
+			if (imageSettingsVal.HasMember(kAdaptiveMinSampleCountStr.c_str()))
+			{
+				const Value& minSampleCountVal = imageSettingsVal.FindMember(kAdaptiveMinSampleCountStr.c_str())->value;
+				assert(!minSampleCountVal.IsNull() && minSampleCountVal.IsInt());
+				scene.settings.imageSettings.adaptiveMinSampleCount = minSampleCountVal.GetInt();
+			}
+
+			if (imageSettingsVal.HasMember(kTimeBudgetStr.c_str()))
+			{
+				const Value& timeBudgetVal = imageSettingsVal.FindMember(kTimeBudgetStr.c_str())->value;
+				assert(!timeBudgetVal.IsNull() && timeBudgetVal.IsNumber());
+				scene.settings.imageSettings.timeBudget = timeBudgetVal.GetFloat();
+			}
+		}
+
+		if (settingsVal.HasMember(kBVHSettingsStr.c_str()))
+		{
+			const Value& bvhSettingsVal = settingsVal.FindMember(kBVHSettingsStr.c_str())->value;
+			assert(!bvhSettingsVal.IsNull() && bvhSettingsVal.IsObject());
+			BVH::BuildSettings& bvhSettings = scene.settings.bvhSettings;
+
+			if (bvhSettingsVal.HasMember(kSplitHeuristicStr.c_str()))
+			{
+				const std::map<std::string, BVH::SplitHeuristic> splitHeuristicMap = {
+					{kSplitHeuristicEqualStr, BVH::SplitHeuristic::Equal},
+					{kSplitHeuristicMiddleStr, BVH::SplitHeuristic::Middle},
+					{kSplitHeuristicSAHStr, BVH::SplitHeuristic::SAH},
+					{kSplitHeuristicSBVHStr, BVH::SplitHeuristic::SBVH},
+					{kSplitHeuristicLBVHStr, BVH::SplitHeuristic::LBVH},
+				};
+
+				const Value& splitHeuristicVal = bvhSettingsVal.FindMember(kSplitHeuristicStr.c_str())->value;
+				assert(!splitHeuristicVal.IsNull() && splitHeuristicVal.IsString());
+				bvhSettings.splitHeuristic = splitHeuristicMap.at(std::string(splitHeuristicVal.GetString()));
+			}
+
+			if (bvhSettingsVal.HasMember(kSAHBinCountStr.c_str()))
+			{
+				const Value& binCountVal = bvhSettingsVal.FindMember(kSAHBinCountStr.c_str())->value;
+				assert(!binCountVal.IsNull() && binCountVal.IsInt());
+				bvhSettings.sahBinCount = binCountVal.GetInt();
+			}
+
+			if (bvhSettingsVal.HasMember(kSpatialSplitAlphaStr.c_str()))
+			{
+				const Value& alphaVal = bvhSettingsVal.FindMember(kSpatialSplitAlphaStr.c_str())->value;
+				assert(!alphaVal.IsNull() && alphaVal.IsNumber());
+				bvhSettings.spatialSplitAlpha = alphaVal.GetFloat();
+			}
+
+			if (bvhSettingsVal.HasMember(kSpatialSplitBudgetStr.c_str()))
+			{
+				const Value& budgetVal = bvhSettingsVal.FindMember(kSpatialSplitBudgetStr.c_str())->value;
+				assert(!budgetVal.IsNull() && budgetVal.IsNumber());
+				bvhSettings.spatialSplitBudget = budgetVal.GetFloat();
+			}
+
+			if (bvhSettingsVal.HasMember(kTreeletOptimizationStr.c_str()))
+			{
+				const Value& treeletVal = bvhSettingsVal.FindMember(kTreeletOptimizationStr.c_str())->value;
+				assert(!treeletVal.IsNull() && treeletVal.IsBool());
+				bvhSettings.treeletOptimization = treeletVal.GetBool();
+			}
+
+			if (bvhSettingsVal.HasMember(kRefitRebuildThresholdStr.c_str()))
+			{
+				const Value& thresholdVal = bvhSettingsVal.FindMember(kRefitRebuildThresholdStr.c_str())->value;
+				assert(!thresholdVal.IsNull() && thresholdVal.IsNumber());
+				bvhSettings.refitRebuildThreshold = thresholdVal.GetFloat();
+			}
+
+			if (bvhSettingsVal.HasMember(kBVHCacheStr.c_str()))
+			{
+				const Value& cacheVal = bvhSettingsVal.FindMember(kBVHCacheStr.c_str())->value;
+				assert(!cacheVal.IsNull() && cacheVal.IsBool());
+				bvhSettings.useCache = cacheVal.GetBool();
+			}
+
+			if (bvhSettingsVal.HasMember(kMaxDepthStr.c_str()))
+			{
+				const Value& maxDepthVal = bvhSettingsVal.FindMember(kMaxDepthStr.c_str())->value;
+				assert(!maxDepthVal.IsNull() && maxDepthVal.IsInt());
+				bvhSettings.maxDepth = maxDepthVal.GetInt();
+			}
+
+			if (bvhSettingsVal.HasMember(kMaxLeafSizeStr.c_str()))
+			{
+				const Value& maxLeafSizeVal = bvhSettingsVal.FindMember(kMaxLeafSizeStr.c_str())->value;
+				assert(!maxLeafSizeVal.IsNull() && maxLeafSizeVal.IsInt());
+				bvhSettings.maxTriangleCountPerLeaf = maxLeafSizeVal.GetInt();
+			}
+
+			if (bvhSettingsVal.HasMember(kParallelBuildStr.c_str()))
+			{
+				const Value& parallelBuildVal = bvhSettingsVal.FindMember(kParallelBuildStr.c_str())->value;
+				assert(!parallelBuildVal.IsNull() && parallelBuildVal.IsBool());
+				bvhSettings.parallelBuild = parallelBuildVal.GetBool();
+			}
+
+			if (bvhSettingsVal.HasMember(kNodeLayoutStr.c_str()))
+			{
+				const std::map<std::string, BVH::NodeLayout> nodeLayoutMap = {
+					{kNodeLayoutBinaryStr, BVH::NodeLayout::Binary},
+					{kNodeLayoutQuantized8Str, BVH::NodeLayout::Quantized8},
+					{kNodeLayoutQuantized16Str, BVH::NodeLayout::Quantized16},
+					{kNodeLayoutWide4Str, BVH::NodeLayout::Wide4},
+					{kNodeLayoutWide8Str, BVH::NodeLayout::Wide8},
+				};
+
+				const Value& nodeLayoutVal = bvhSettingsVal.FindMember(kNodeLayoutStr.c_str())->value;
+				assert(!nodeLayoutVal.IsNull() && nodeLayoutVal.IsString());
+				bvhSettings.nodeLayout = nodeLayoutMap.at(std::string(nodeLayoutVal.GetString()));
+			}
+
+			if (bvhSettingsVal.HasMember(kNodeOrderStr.c_str()))
+			{
+				const std::map<std::string, BVH::NodeOrder> nodeOrderMap = {
+					{kNodeOrderDepthFirstStr, BVH::NodeOrder::DepthFirst},
+					{kNodeOrderVanEmdeBoasStr, BVH::NodeOrder::VanEmdeBoas},
+					{kNodeOrderAccessFrequencyStr, BVH::NodeOrder::AccessFrequency},
+				};
+
+				const Value& nodeOrderVal = bvhSettingsVal.FindMember(kNodeOrderStr.c_str())->value;
+				assert(!nodeOrderVal.IsNull() && nodeOrderVal.IsString());
+				bvhSettings.nodeOrder = nodeOrderMap.at(std::string(nodeOrderVal.GetString()));
+			}
+
+			if (bvhSettingsVal.HasMember(kNodeOrderProfileSampleCountStr.c_str()))
+			{
+				const Value& profileSampleCountVal = bvhSettingsVal.FindMember(kNodeOrderProfileSampleCountStr.c_str())->value;
+				assert(!profileSampleCountVal.IsNull() && profileSampleCountVal.IsInt());
+				bvhSettings.nodeOrderProfileSampleCount = profileSampleCountVal.GetInt();
+			}
+
+			if (bvhSettingsVal.HasMember(kTraversalOrderStr.c_str()))
+			{
+				const std::map<std::string, BVH::TraversalOrder> traversalOrderMap = {
+					{kTraversalOrderSplitAxisStr, BVH::TraversalOrder::SplitAxis},
+					{kTraversalOrderDistanceStr, BVH::TraversalOrder::Distance},
+				};
+
+				const Value& traversalOrderVal = bvhSettingsVal.FindMember(kTraversalOrderStr.c_str())->value;
+				assert(!traversalOrderVal.IsNull() && traversalOrderVal.IsString());
+				bvhSettings.traversalOrder = traversalOrderMap.at(std::string(traversalOrderVal.GetString()));
+			}
+
+			if (bvhSettingsVal.HasMember(kLeafPackWidthStr.c_str()))
+			{
+				const Value& leafPackWidthVal = bvhSettingsVal.FindMember(kLeafPackWidthStr.c_str())->value;
+				assert(!leafPackWidthVal.IsNull() && leafPackWidthVal.IsInt());
+				bvhSettings.leafPackWidth = leafPackWidthVal.GetInt();
+				if (bvhSettings.leafPackWidth != 0 && bvhSettings.leafPackWidth != 4 && bvhSettings.leafPackWidth != 8)
+					throw std::runtime_error("leaf_pack_width must be 0, 4 or 8");
+			}
 		}
 	}
 
@@ -328,10 +532,58 @@ void SceneParser::parseSceneFile(const std::string& fileName) const
 		}
 	}
 
+	// Objects referenced by instances become meshes placed only through their instances
+	std::map<uint32_t, uint32_t> objectMeshIndices;
+	if (doc.HasMember(kInstancesStr.c_str()))
+	{
+		const Value& instancesValue = doc.FindMember(kInstancesStr.c_str())->value;
+		assert(!instancesValue.IsNull() && instancesValue.IsArray());
+
+		const Value& objectsValue = doc.FindMember(kObjectsStr.c_str())->value;
+		const int64_t objectCount = !objectsValue.IsNull() && objectsValue.IsArray() ? objectsValue.Size() : 0;
+		for (Value::ConstValueIterator it = instancesValue.Begin(); it != instancesValue.End(); ++it)
+		{
+			const Value& objectIndexValue = it->FindMember(kObjectIndexStr.c_str())->value;
+			assert(!objectIndexValue.IsNull() && objectIndexValue.IsInt());
+			if (objectIndexValue.GetInt() < 0 || objectIndexValue.GetInt() >= objectCount)
+			{
+				std::ostringstream oss;
+				oss << "Instance object_index " << objectIndexValue.GetInt() << " is out of range, the scene has "
+					<< objectCount << " objects";
+				throw std::runtime_error(oss.str());
+			}
+			const auto objectIndex = static_cast<uint32_t>(objectIndexValue.GetInt());
+
+			Matrix4 rotation = Matrix4::identity();
+			if (it->HasMember(kMatrixStr.c_str()))
+			{
+				const Value& matrixVal = it->FindMember(kMatrixStr.c_str())->value;
+				assert(!matrixVal.IsNull() && matrixVal.IsArray());
+				rotation = loadMatrix(matrixVal.GetArray());
+			}
+
+			Matrix4 translation = Matrix4::identity();
+			if (it->HasMember(kPositionStr.c_str()))
+			{
+				const Value& positionVal = it->FindMember(kPositionStr.c_str())->value;
+				assert(!positionVal.IsNull() && positionVal.IsArray());
+				translation = makeTranslation(loadVector(positionVal.GetArray()));
+			}
+
+			auto [meshIt, inserted] = objectMeshIndices.emplace(objectIndex, static_cast<uint32_t>(scene.meshes.size()));
+			if (inserted)
+				scene.meshes.emplace_back();
+
+			scene.instances.emplace_back(meshIt->second, translation * rotation);
+		}
+	}
+
 	const Value& objectsValue = doc.FindMember(kObjectsStr.c_str())->value;
 	if (!objectsValue.IsNull() && objectsValue.IsArray())
 	{
-		for (Value::ConstValueIterator it = objectsValue.Begin(); it != objectsValue.End(); ++it)
+		std::vector<int32_t> meshEmissiveCounts(scene.meshes.size(), 0);
+		uint32_t objectIndex = 0;
+		for (Value::ConstValueIterator it = objectsValue.Begin(); it != objectsValue.End(); ++it, ++objectIndex)
 		{
 			const Value& verticesValue = it->FindMember(kVerticesStr.c_str())->value;
 			assert(!verticesValue.IsNull() && verticesValue.IsArray());
@@ -376,38 +628,69 @@ void SceneParser::parseSceneFile(const std::string& fileName) const
 			const auto& material = scene.materials[materialIndex];
 			bool isEmissive = material.type == Material::Type::EMISSIVE;
 
-			scene.triangles.reserve(scene.triangles.size() + indices.size() / 3);
-			for (uint32_t i = 0; i < indices.size(); i += 3)
+			// Instanced meshes number their emissive triangles locally, every instance gets its own block later
+			auto meshIndexIt = objectMeshIndices.find(objectIndex);
+			const bool isInstanced = meshIndexIt != objectMeshIndices.end();
+			VertexBuffer& vertexBuffer = isInstanced
+				? scene.meshes[meshIndexIt->second].vertices
+				: scene.vertices;
+			std::vector<Triangle>& triangles = isInstanced
+				? scene.meshes[meshIndexIt->second].triangles
+				: scene.triangles;
+			auto nextEmissiveIndex = [&]
 			{
-				const auto& i0 = indices[i];
-				const auto& i1 = indices[i + 1];
-				const auto& i2 = indices[i + 2];
-
-				const auto& v0 = vertices[i0];
-				const auto& v1 = vertices[i1];
-				const auto& v2 = vertices[i2];
-
-				const auto& n0 = vertexNormals[i0];
-				const auto& n1 = vertexNormals[i1];
-				const auto& n2 = vertexNormals[i2];
-
-				const auto& uv0 = !uvs.empty() ? uvs[i0] : 1.f;
-				const auto& uv1 = !uvs.empty() ? uvs[i1] : 1.f;
-				const auto& uv2 = !uvs.empty() ? uvs[i2] : 1.f;
+				if (!isInstanced)
+					return static_cast<int32_t>(scene.emissiveSampler.emissiveTriangles.size());
+
+				return meshEmissiveCounts[meshIndexIt->second]++;
+			};
+
+			// Objects sharing a vertex buffer are appended to it, their indices are offset past the earlier ones
+			const auto firstVertex = static_cast<uint32_t>(vertexBuffer.positions.size());
+			vertexBuffer.positions.insert(vertexBuffer.positions.end(), vertices.begin(), vertices.end());
+			vertexBuffer.normals.insert(vertexBuffer.normals.end(), vertexNormals.begin(), vertexNormals.end());
+			if (!uvs.empty())
+				vertexBuffer.uvs.insert(vertexBuffer.uvs.end(), uvs.begin(), uvs.end());
+			else
+				vertexBuffer.uvs.resize(vertexBuffer.positions.size(), 1.f);
 
-				scene.triangles.emplace_back(
-					Vertex{v0, n0, uv0},
-					Vertex{v1, n1, uv1},
-					Vertex{v2, n2, uv2},
+			triangles.reserve(triangles.size() + indices.size() / 3);
+			for (uint32_t i = 0; i < indices.size(); i += 3)
+			{
+				triangles.emplace_back(
+					firstVertex + indices[i],
+					firstVertex + indices[i + 1],
+					firstVertex + indices[i + 2],
 					materialIndex,
-					isEmissive ? scene.emissiveSampler.emissiveTriangles.size() : -1
+					isEmissive ? nextEmissiveIndex() : -1
 				);
 
-				if (isEmissive)
+				if (isEmissive && !isInstanced)
 				{
-					scene.emissiveSampler.emissiveTriangles.emplace_back(scene.triangles.back(), material.emission);
+					scene.emissiveSampler.emissiveTriangles.emplace_back(vertices[indices[i]], vertices[indices[i + 1]],
+						vertices[indices[i + 2]], material.emission);
 				}
 			}
 		}
 	}
+
+	// Emissive triangles of instanced meshes are sampled in world space, in the order of their local indices
+	for (auto& instance : scene.instances)
+	{
+		const Mesh& mesh = scene.meshes[instance.meshIndex];
+		for (const auto& triangle : mesh.triangles)
+		{
+			if (triangle.emissiveIndex == -1)
+				continue;
+
+			if (instance.emissiveOffset == -1)
+				instance.emissiveOffset = static_cast<int32_t>(scene.emissiveSampler.emissiveTriangles.size());
+
+			scene.emissiveSampler.emissiveTriangles.emplace_back(
+				instance.pointToWorld(triangle.getPosition(mesh.vertices, 0)),
+				instance.pointToWorld(triangle.getPosition(mesh.vertices, 1)),
+				instance.pointToWorld(triangle.getPosition(mesh.vertices, 2)),
+				scene.materials[triangle.materialIndex].emission);
+		}
+	}
 }
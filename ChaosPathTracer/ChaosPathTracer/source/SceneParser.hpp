@@ -13,18 +13,60 @@ class SceneParser final
 private:
 	inline static const std::string kSceneSettingsStr{"settings"};
 	inline static const std::string kBackgroundColorStr{"background_color"};
+	inline static const std::string kCompactVertexAttributesStr{"compact_vertex_attributes"};
 	inline static const std::string kImageSettingsStr{"image_settings"};
 	inline static const std::string kImageWidthStr{"width"};
 	inline static const std::string kImageHeightStr{"height"};
 	inline static const std::string kBucketSizeStr{"bucket_size"};
 	inline static const std::string kSampleCountStr{"sample_count"};
 	inline static const std::string kTraceDepthStr{"trace_depth"};
+	inline static const std::string kRayPacketSizeStr{"ray_packet_size"};
+	inline static const std::string kWavefrontStr{"wavefront"};
+	inline static const std::string kCostAwareBucketsStr{"cost_aware_buckets"};
+	inline static const std::string kPassSampleCountStr{"pass_sample_count"};
+	inline static const std::string kPassWriteIntervalStr{"pass_write_interval"};
+	inline static const std::string kAdaptiveErrorThresholdStr{"adaptive_error_threshold"};
+	inline static const std::string kAdaptiveMinSampleCountStr{"adaptive_min_sample_count"};
+	inline static const std::string kTimeBudgetStr{"time_budget"};
+	inline static const std::string kBVHSettingsStr{"bvh_settings"};
+	inline static const std::string kSplitHeuristicStr{"split_heuristic"};
+	inline static const std::string kSplitHeuristicEqualStr{"equal"};
+	inline static const std::string kSplitHeuristicMiddleStr{"middle"};
+	inline static const std::string kSplitHeuristicSAHStr{"sah"};
+	inline static const std::string kSplitHeuristicSBVHStr{"sbvh"};
+	inline static const std::string kSplitHeuristicLBVHStr{"lbvh"};
+	inline static const std::string kSpatialSplitAlphaStr{"sbvh_alpha"};
+	inline static const std::string kSpatialSplitBudgetStr{"sbvh_memory_budget"};
+	inline static const std::string kTreeletOptimizationStr{"lbvh_treelet_optimization"};
+	inline static const std::string kRefitRebuildThresholdStr{"refit_rebuild_threshold"};
+	inline static const std::string kBVHCacheStr{"cache"};
+	inline static const std::string kSAHBinCountStr{"sah_bin_count"};
+	inline static const std::string kMaxDepthStr{"max_depth"};
+	inline static const std::string kMaxLeafSizeStr{"max_leaf_size"};
+	inline static const std::string kParallelBuildStr{"parallel_build"};
+	inline static const std::string kNodeLayoutStr{"node_layout"};
+	inline static const std::string kNodeLayoutBinaryStr{"binary"};
+	inline static const std::string kNodeLayoutQuantized8Str{"quantized8"};
+	inline static const std::string kNodeLayoutQuantized16Str{"quantized16"};
+	inline static const std::string kNodeLayoutWide4Str{"bvh4"};
+	inline static const std::string kNodeLayoutWide8Str{"bvh8"};
+	inline static const std::string kNodeOrderStr{"node_order"};
+	inline static const std::string kNodeOrderDepthFirstStr{"depth_first"};
+	inline static const std::string kNodeOrderVanEmdeBoasStr{"van_emde_boas"};
+	inline static const std::string kNodeOrderAccessFrequencyStr{"access_frequency"};
+	inline static const std::string kNodeOrderProfileSampleCountStr{"node_order_profile_samples"};
+	inline static const std::string kTraversalOrderStr{"traversal_order"};
+	inline static const std::string kTraversalOrderSplitAxisStr{"split_axis"};
+	inline static const std::string kTraversalOrderDistanceStr{"distance"};
+	inline static const std::string kLeafPackWidthStr{"leaf_pack_width"};
 	inline static const std::string kCameraStr{"camera"};
 	inline static const std::string kMatrixStr{"matrix"};
 	inline static const std::string kLightsStr{"lights"};
 	inline static const std::string kIntensityStr{"intensity"};
 	inline static const std::string kPositionStr{"position"};
 	inline static const std::string kObjectsStr{"objects"};
+	inline static const std::string kInstancesStr{"instances"};
+	inline static const std::string kObjectIndexStr{"object_index"};
 	inline static const std::string kVerticesStr{"vertices"};
 	inline static const std::string kUVsStr{"uvs"};
 	inline static const std::string kTrianglesStr{"triangles"};
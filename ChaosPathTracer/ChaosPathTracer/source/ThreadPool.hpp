@@ -1,40 +1,54 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <mutex>
-#include <queue>
+#include <memory>
 #include <functional>
 #include <vector>
 #include <condition_variable>
 #include <future>
+#include <stdexcept>
+#include <thread>
 
+// Work-stealing pool. Every worker owns a lock-free deque, it pushes and pops its tasks at the bottom while idle
+// workers steal from the top, where the oldest and largest pieces of work are. Tasks from threads outside the
+// pool are handed to the inbox of one worker
 class ThreadPool
 {
 public:
 	ThreadPool(size_t numThreads = std::jthread::hardware_concurrency())
 	{
+		for (size_t i = 0; i < numThreads; ++i)
+			workers.push_back(std::make_unique<Worker>());
+
 		for (size_t i = 0; i < numThreads; ++i)
 		{
-			workers.emplace_back([this](std::stop_token stop_token) { WorkerThread(stop_token); });
+			workers[i]->thread = std::jthread([this, i](std::stop_token stop_token)
+			{
+				WorkerThread(stop_token, static_cast<uint32_t>(i));
+			});
 		}
 	}
 
 	~ThreadPool()
 	{
+		for (auto& worker : workers)
+			worker->thread.request_stop();
+
 		{
-			std::scoped_lock lock(queueMutex);
+			std::scoped_lock lock(sleepMutex);
 			stopping = true;
 		}
-
-		for (auto& worker : workers)
-			worker.request_stop();
-
-		condition.notify_all();
+		sleepCondition.notify_all();
 
 		for (auto& worker : workers)
 		{
-			if (worker.joinable())
+			if (worker->thread.joinable())
 			{
-				worker.join();
+				worker->thread.join();
 			}
 		}
 	}
@@ -49,43 +63,369 @@ public:
 		);
 
 		std::future<return_type> res = task->get_future();
+		if (stopping)
+			throw std::runtime_error("Enqueue on stopped ThreadPool");
+
+		auto* job = new FunctionJob{{&FunctionJob::Execute}, [task]() { (*task)(); }};
+		Submit(Task{job, 0, 0}, nextInbox.fetch_add(1, std::memory_order_relaxed));
+		return res;
+	}
+
+	// Calls func(first, last) for disjoint subranges of [begin, end) of at most grainSize items, without
+	// futures or allocations per subrange, and returns once all of them are done. Affinity: piece i of the
+	// range starts in the inbox of worker i, so loops over the same range run mostly on the same threads.
+	// The pieces are split in halves on demand, and the halves are stolen by idle workers. func must not throw
+	template <class Func>
+	void ParallelFor(uint32_t begin, uint32_t end, uint32_t grainSize, Func&& func)
+	{
+		if (begin >= end)
+			return;
+
+		grainSize = std::max(grainSize, 1u);
+		if (workers.empty() || end - begin <= grainSize)
 		{
-			std::scoped_lock lock(queueMutex);
+			func(begin, end);
+			return;
+		}
 
-			if (stopping)
-				throw std::runtime_error("Enqueue on stopped ThreadPool");
+		RangeJob<std::remove_reference_t<Func>> job{{&RangeJob<std::remove_reference_t<Func>>::Execute}, func,
+		                                            grainSize, end - begin};
+		if (currentPool == this)
+		{
+			// Nested loop of a worker, it runs the range itself and keeps busy with other tasks while thieves
+			// finish the halves
+			job.execute(*this, job, begin, end);
+			while (job.remainingCount.load(std::memory_order_acquire) != 0)
+			{
+				if (!RunTask(currentWorkerIndex))
+					std::this_thread::yield();
+			}
+			return;
+		}
 
-			tasks.emplace([task]() { (*task)(); });
+		const uint64_t count = end - begin;
+		const auto pieceCount = static_cast<uint32_t>(std::min<uint64_t>(workers.size(),
+		                                                                   (count + grainSize - 1) / grainSize));
+		for (uint32_t piece = 0; piece < pieceCount; ++piece)
+		{
+			const auto pieceBegin = static_cast<uint32_t>(begin + count * piece / pieceCount);
+			const auto pieceEnd = static_cast<uint32_t>(begin + count * (piece + 1) / pieceCount);
+			Submit(Task{&job, pieceBegin, pieceEnd}, piece);
 		}
-		condition.notify_one();
-		return res;
+
+		std::unique_lock lock(completionMutex);
+		completionCondition.wait(lock, [&job] { return job.remainingCount.load(std::memory_order_acquire) == 0; });
+	}
+
+	size_t GetThreadCount() const
+	{
+		return workers.size();
+	}
+
+	// Index of the calling worker, 0 on threads outside the pool
+	static uint32_t GetCurrentThreadIndex()
+	{
+		return currentWorkerIndex;
 	}
 
 private:
-	void WorkerThread(std::stop_token stop_token)
+	// Type-erased work behind a task, execute runs the items [begin, end) of the job
+	struct Job
 	{
-		while (true)
+		void (*execute)(ThreadPool& pool, Job& job, uint32_t begin, uint32_t end);
+	};
+
+	// Enqueued callable, deleted once it ran
+	struct FunctionJob : Job
+	{
+		std::function<void()> function;
+
+		static void Execute(ThreadPool&, Job& job, uint32_t, uint32_t)
+		{
+			auto* functionJob = static_cast<FunctionJob*>(&job);
+			functionJob->function();
+			delete functionJob;
+		}
+	};
+
+	// Loop of ParallelFor, lives on the stack of its caller until remainingCount drops to 0
+	template <class Func>
+	struct RangeJob : Job
+	{
+		Func& func;
+		uint32_t grainSize;
+		std::atomic<uint32_t> remainingCount;
+
+		// Keeps the lower half and pushes the upper one for thieves until the range fits the grain size
+		static void Execute(ThreadPool& pool, Job& job, uint32_t begin, uint32_t end)
+		{
+			auto& rangeJob = static_cast<RangeJob&>(job);
+			while (end - begin > rangeJob.grainSize)
+			{
+				const uint32_t mid = begin + (end - begin) / 2;
+				pool.Push(Task{&job, mid, end});
+				end = mid;
+			}
+
+			rangeJob.func(begin, end);
+
+			// The caller may return as soon as the count reaches 0, the job must not be touched afterwards
+			if (rangeJob.remainingCount.fetch_sub(end - begin, std::memory_order_acq_rel) == end - begin)
+			{
+				std::scoped_lock lock(pool.completionMutex);
+				pool.completionCondition.notify_all();
+			}
+		}
+	};
+
+	struct Task
+	{
+		Job* job = nullptr;
+		uint32_t begin = 0;
+		uint32_t end = 0;
+	};
+
+	// Chase-Lev deque, see Le et al., Correct and Efficient Work-Stealing for Weak Memory Models. Only the owner
+	// pushes and pops at the bottom, any thread steals at the top. Outgrown buffers are kept until the pool is
+	// destroyed, as a thief may still read from them
+	class WorkStealingDeque
+	{
+	public:
+		WorkStealingDeque()
+		{
+			buffers.push_back(std::make_unique<Buffer>(initialCapacity));
+			buffer.store(buffers.back().get(), std::memory_order_relaxed);
+		}
+
+		void Push(const Task& task)
+		{
+			const int64_t b = bottom.load(std::memory_order_relaxed);
+			const int64_t t = top.load(std::memory_order_acquire);
+			Buffer* currentBuffer = buffer.load(std::memory_order_relaxed);
+			if (b - t > static_cast<int64_t>(currentBuffer->mask))
+				currentBuffer = Grow(currentBuffer, t, b);
+
+			currentBuffer->Put(b, task);
+			bottom.store(b + 1, std::memory_order_release);
+		}
+
+		bool Pop(Task& task)
+		{
+			const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+			Buffer* currentBuffer = buffer.load(std::memory_order_relaxed);
+			bottom.store(b, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			int64_t t = top.load(std::memory_order_relaxed);
+			if (t > b)
+			{
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return false;
+			}
+
+			task = currentBuffer->Get(b);
+			if (t == b)
+			{
+				// Last task, race the thieves for it
+				const bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+				                                             std::memory_order_relaxed);
+				bottom.store(b + 1, std::memory_order_relaxed);
+				return won;
+			}
+			return true;
+		}
+
+		bool Steal(Task& task)
 		{
-			std::function<void()> task;
+			int64_t t = top.load(std::memory_order_acquire);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			const int64_t b = bottom.load(std::memory_order_acquire);
+			if (t >= b)
+				return false;
+
+			task = buffer.load(std::memory_order_acquire)->Get(t);
+			return top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		}
+
+	private:
+		// Slots are atomic so that a thief reading a slot the owner reuses is not a data race, the failed
+		// compare-exchange on top discards what it read
+		struct Slot
+		{
+			std::atomic<Job*> job;
+			std::atomic<uint64_t> range;
+		};
+
+		struct Buffer
+		{
+			size_t mask;
+			std::unique_ptr<Slot[]> slots;
+
+			explicit Buffer(size_t capacity)
+				: mask(capacity - 1), slots(std::make_unique<Slot[]>(capacity))
+			{
+			}
+
+			void Put(int64_t index, const Task& task)
+			{
+				Slot& slot = slots[static_cast<size_t>(index) & mask];
+				slot.job.store(task.job, std::memory_order_relaxed);
+				slot.range.store(static_cast<uint64_t>(task.end) << 32 | task.begin, std::memory_order_relaxed);
+			}
+
+			Task Get(int64_t index) const
+			{
+				const Slot& slot = slots[static_cast<size_t>(index) & mask];
+				const uint64_t range = slot.range.load(std::memory_order_relaxed);
+				return {slot.job.load(std::memory_order_relaxed), static_cast<uint32_t>(range),
+				        static_cast<uint32_t>(range >> 32)};
+			}
+		};
+
+		Buffer* Grow(Buffer* oldBuffer, int64_t t, int64_t b)
+		{
+			buffers.push_back(std::make_unique<Buffer>((oldBuffer->mask + 1) * 2));
+			Buffer* newBuffer = buffers.back().get();
+			for (int64_t index = t; index < b; ++index)
+				newBuffer->Put(index, oldBuffer->Get(index));
+			buffer.store(newBuffer, std::memory_order_release);
+			return newBuffer;
+		}
+
+		static constexpr size_t initialCapacity = 256;
+
+		alignas(64) std::atomic<int64_t> top{0};
+		alignas(64) std::atomic<int64_t> bottom{0};
+		std::atomic<Buffer*> buffer;
+		std::vector<std::unique_ptr<Buffer>> buffers;
+	};
+
+	struct alignas(64) Worker
+	{
+		WorkStealingDeque deque;
+		std::mutex inboxMutex;
+		std::deque<Task> inbox;
+		std::jthread thread;
+	};
+
+	// Onto the deque of the calling worker, only called from the pool threads
+	void Push(const Task& task)
+	{
+		workers[currentWorkerIndex]->deque.Push(task);
+		OnTaskAdded();
+	}
+
+	// From any thread: the deque of the calling worker, the inbox of the hinted worker otherwise
+	void Submit(const Task& task, size_t workerHint)
+	{
+		if (workers.empty())
+		{
+			task.job->execute(*this, *task.job, task.begin, task.end);
+			return;
+		}
+
+		if (currentPool == this)
+		{
+			Push(task);
+			return;
+		}
+
+		Worker& worker = *workers[workerHint % workers.size()];
+		{
+			std::scoped_lock lock(worker.inboxMutex);
+			worker.inbox.push_back(task);
+		}
+		OnTaskAdded();
+	}
+
+	void OnTaskAdded()
+	{
+		pendingTaskCount.fetch_add(1, std::memory_order_seq_cst);
+		if (sleepingCount.load(std::memory_order_seq_cst) > 0)
+		{
+			std::scoped_lock lock(sleepMutex);
+			sleepCondition.notify_one();
+		}
+	}
+
+	// Own deque first, then the own inbox, then the other workers from the next one on
+	bool FindTask(uint32_t workerIndex, Task& task)
+	{
+		Worker& worker = *workers[workerIndex];
+		if (worker.deque.Pop(task))
+			return true;
+
+		{
+			std::scoped_lock lock(worker.inboxMutex);
+			if (!worker.inbox.empty())
+			{
+				task = worker.inbox.front();
+				worker.inbox.pop_front();
+				return true;
+			}
+		}
+
+		const auto workerCount = static_cast<uint32_t>(workers.size());
+		for (uint32_t offset = 1; offset < workerCount; ++offset)
+		{
+			Worker& victim = *workers[(workerIndex + offset) % workerCount];
+			if (victim.deque.Steal(task))
+				return true;
+
+			std::unique_lock lock(victim.inboxMutex, std::try_to_lock);
+			if (lock.owns_lock() && !victim.inbox.empty())
 			{
-				std::unique_lock lock(queueMutex);
-				condition.wait(lock, stop_token, [this] { return stopping || !tasks.empty(); });
-				if (tasks.empty() && stop_token.stop_requested())
-					return;
-				if (!tasks.empty())
-				{
-					task = std::move(tasks.front());
-					tasks.pop();
-				}
+				task = victim.inbox.front();
+				victim.inbox.pop_front();
+				return true;
 			}
-			if (task)
-				task();
+		}
+		return false;
+	}
+
+	bool RunTask(uint32_t workerIndex)
+	{
+		Task task;
+		if (!FindTask(workerIndex, task))
+			return false;
+
+		pendingTaskCount.fetch_sub(1, std::memory_order_relaxed);
+		task.job->execute(*this, *task.job, task.begin, task.end);
+		return true;
+	}
+
+	void WorkerThread(std::stop_token stop_token, uint32_t workerIndex)
+	{
+		currentPool = this;
+		currentWorkerIndex = workerIndex;
+		while (true)
+		{
+			if (RunTask(workerIndex))
+				continue;
+
+			// Sleep until some task is queued. The count is raised before a sleeper is looked for, so either
+			// the wait sees the task or the submitter sees the sleeper
+			std::unique_lock lock(sleepMutex);
+			sleepingCount.fetch_add(1, std::memory_order_seq_cst);
+			sleepCondition.wait(lock, stop_token, [this]
+			{
+				return stopping || pendingTaskCount.load(std::memory_order_seq_cst) > 0;
+			});
+			sleepingCount.fetch_sub(1, std::memory_order_seq_cst);
+			if (stop_token.stop_requested() && pendingTaskCount.load(std::memory_order_seq_cst) == 0)
+				return;
 		}
 	}
 
-	std::vector<std::jthread> workers;
-	std::queue<std::function<void()>> tasks;
-	std::mutex queueMutex;
-	std::condition_variable_any condition;
-	bool stopping = false;
+	inline static thread_local ThreadPool* currentPool = nullptr;
+	inline static thread_local uint32_t currentWorkerIndex = 0;
+
+	std::vector<std::unique_ptr<Worker>> workers;
+	std::atomic<int64_t> pendingTaskCount{0}; // queued tasks that no worker took yet
+	std::atomic<uint32_t> sleepingCount{0};
+	std::atomic<size_t> nextInbox{0};
+	std::mutex sleepMutex;
+	std::condition_variable_any sleepCondition;
+	std::mutex completionMutex;
+	std::condition_variable completionCondition;
+	std::atomic<bool> stopping = false;
 };
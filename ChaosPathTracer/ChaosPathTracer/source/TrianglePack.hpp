@@ -0,0 +1,135 @@
+#pragma once
+#include <cstdint>
+#include <vector>
+
+#include "Material.hpp"
+#include "Math3D.hpp"
+#include "SIMD.hpp"
+
+// Up to Width triangles of a leaf as structure of arrays, so that one Moller-Trumbore test in SIMD lanes covers
+// the whole pack. Built from the intersection records, see IntersectionTriangle. Every row is aligned for the
+// SIMD loads
+template <uint32_t Width>
+struct alignas(sizeof(float) * Width) TrianglePack
+{
+	using FloatW = typename SIMD::FloatN<Width>::Type;
+
+	float v0[3][Width];
+	float edge1[3][Width];
+	float edge2[3][Width];
+	uint32_t cullMask = 0; // lanes whose material culls back faces
+	uint32_t occluderMask = 0; // lanes that block shadow rays, all but the refractive ones
+
+	// Unused lanes keep degenerate triangles, which are never hit
+	TrianglePack()
+	{
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			for (uint32_t lane = 0; lane < Width; ++lane)
+			{
+				v0[axis][lane] = 0.f;
+				edge1[axis][lane] = 0.f;
+				edge2[axis][lane] = 0.f;
+			}
+		}
+	}
+
+	void setTriangle(uint32_t lane, const IntersectionTriangle& triangle, const Material& material)
+	{
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			v0[axis][lane] = triangle.v0[axis];
+			edge1[axis][lane] = triangle.edge1[axis];
+			edge2[axis][lane] = triangle.edge2[axis];
+		}
+		if (material.cullBackFace())
+			cullMask |= 1u << lane;
+		if (material.type != Material::Type::REFRACTIVE)
+			occluderMask |= 1u << lane;
+	}
+
+	// Lanes of the first laneCount triangles of a pack
+	static uint32_t getLaneMask(uint32_t laneCount)
+	{
+		return laneCount >= Width ? (1u << Width) - 1 : (1u << laneCount) - 1;
+	}
+
+	// Bit mask of the lanes in laneMask that the ray hits closer than maxT, with the same test as
+	// IntersectionTriangle::intersect. t, u and v receive the hit distances and barycentrics of every lane
+	uint32_t intersect(const FloatW* origin, const FloatW* direction, float maxT, uint32_t laneMask, float* t, float* u,
+	                   float* v) const
+	{
+		const FloatW zero = FloatW::broadcast(0.f);
+		const FloatW one = FloatW::broadcast(1.f);
+		const FloatW e1[3] = {FloatW::load(edge1[0]), FloatW::load(edge1[1]), FloatW::load(edge1[2])};
+		const FloatW e2[3] = {FloatW::load(edge2[0]), FloatW::load(edge2[1]), FloatW::load(edge2[2])};
+
+		// p = Cross(direction, edge2), the determinant is positive for front faces
+		const FloatW p[3] = {direction[1] * e2[2] - direction[2] * e2[1],
+		                     direction[2] * e2[0] - direction[0] * e2[2],
+		                     direction[0] * e2[1] - direction[1] * e2[0]};
+		const FloatW det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		laneMask &= SIMD::lessMask(zero, det) | (SIMD::lessMask(det, zero) & ~cullMask);
+		if (laneMask == 0)
+			return 0;
+
+		const FloatW invDet = one / det;
+		const FloatW s[3] = {origin[0] - FloatW::load(v0[0]), origin[1] - FloatW::load(v0[1]),
+		                     origin[2] - FloatW::load(v0[2])};
+		const FloatW laneU = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * invDet;
+
+		// q = Cross(s, edge1)
+		const FloatW q[3] = {s[1] * e1[2] - s[2] * e1[1],
+		                     s[2] * e1[0] - s[0] * e1[2],
+		                     s[0] * e1[1] - s[1] * e1[0]};
+		const FloatW laneV = (direction[0] * q[0] + direction[1] * q[1] + direction[2] * q[2]) * invDet;
+		const FloatW laneT = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * invDet;
+
+		laneMask &= ~(SIMD::lessMask(laneU, zero) | SIMD::lessMask(laneV, zero) | SIMD::lessMask(one, laneU + laneV) |
+			SIMD::lessMask(laneT, zero) | SIMD::lessMask(FloatW::broadcast(maxT), laneT));
+
+		laneT.store(t);
+		laneU.store(u);
+		laneV.store(v);
+		return laneMask;
+	}
+};
+
+// Intersection data the BVH queries test, in the BVH order of the triangles: one record per triangle, and
+// the leaves as SIMD packs when the BVH was built with a leaf pack width. Every leaf then starts at a
+// multiple of the width, so the packs of a leaf start at its triangle offset divided by the width
+struct IntersectionBuffer
+{
+	std::vector<IntersectionTriangle> triangles;
+	std::vector<TrianglePack<4>> packs4;
+	std::vector<TrianglePack<8>> packs8;
+
+	void build(const std::vector<Triangle>& sourceTriangles, const VertexBuffer& vertices,
+	           const std::vector<Material>& materials, uint32_t packWidth)
+	{
+		triangles.clear();
+		triangles.reserve(sourceTriangles.size());
+		for (const auto& triangle : sourceTriangles)
+			triangles.emplace_back(triangle, vertices);
+
+		packs4.clear();
+		packs8.clear();
+		if (packWidth == 4)
+			buildPacks(materials, packs4);
+		else if (packWidth == 8)
+			buildPacks(materials, packs8);
+	}
+
+private:
+	template <uint32_t Width>
+	void buildPacks(const std::vector<Material>& materials, std::vector<TrianglePack<Width>>& packs) const
+	{
+		packs.resize((triangles.size() + Width - 1) / Width);
+		for (uint32_t triangleIndex = 0; triangleIndex < triangles.size(); ++triangleIndex)
+		{
+			const IntersectionTriangle& triangle = triangles[triangleIndex];
+			const Material& material = materials[triangle.materialIndex];
+			packs[triangleIndex / Width].setTriangle(triangleIndex % Width, triangle, material);
+		}
+	}
+};
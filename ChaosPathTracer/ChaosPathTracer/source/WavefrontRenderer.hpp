@@ -0,0 +1,367 @@
+#pragma once
+
+#include <array>
+#include <cassert>
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "Film.hpp"
+#include "Sampling.hpp"
+#include "Scene.hpp"
+
+// Path tracing of a bucket in stages instead of depth-first recursion. One sample of every pixel of the bucket is
+// traced at a time, bounce by bounce: the closest hits of all paths, then shading grouped by material type, which
+// queues shadow rays and the paths of the next bounce, then the shadow rays. Each stage runs over the whole queue,
+// so the traversal, the shading of one material and the occlusion tests stay warm in the caches. Estimates the
+// same radiance as Renderer::traceRay
+class WavefrontRenderer final
+{
+public:
+	WavefrontRenderer(const Scene& scene, OccluderCache& occluderCache)
+		: scene(scene), occluderCache(occluderCache)
+	{}
+
+	// Adds sampleCount samples of every pixel of the bucket to the film
+	void renderBucket(Film& film, uint32_t startRow, uint32_t endRow, uint32_t startColumn, uint32_t endColumn,
+	                  uint32_t sampleCount)
+	{
+		const uint32_t bucketWidth = endColumn - startColumn;
+		for (uint32_t sample = 0; sample < sampleCount; sample++)
+		{
+			radiance.assign(bucketWidth * (endRow - startRow), Vector3{0.f});
+			generate(film, startRow, endRow, startColumn, endColumn);
+			for (uint32_t depth = 0; !paths.empty(); ++depth)
+			{
+				extend();
+				shade(depth < scene.settings.imageSettings.traceDepth);
+				traceShadowRays();
+
+				std::swap(paths, nextPaths);
+				nextPaths.clear();
+			}
+
+			for (uint32_t rowIdx = startRow; rowIdx < endRow; ++rowIdx)
+			{
+				for (uint32_t colIdx = startColumn; colIdx < endColumn; ++colIdx)
+				{
+					const uint32_t pixelIndex = (rowIdx - startRow) * bucketWidth + colIdx - startColumn;
+					if (!film.isConverged(colIdx, rowIdx))
+						film.addSample(colIdx, rowIdx, radiance[pixelIndex]);
+				}
+			}
+		}
+	}
+
+private:
+	// Paths of one bounce as structure of arrays
+	struct PathQueue
+	{
+		std::vector<Ray> rays;
+		std::vector<HitInfo> hitInfos;
+		std::vector<Vector3> throughputs; // weight of the radiance arriving along the ray
+		std::vector<uint32_t> pixelIndices; // into radiance
+		std::vector<float> neeBsdfPdfs; // pdf of the diffuse bounce that also sampled the emissive geometry, 0 otherwise
+
+		void push(const Ray& ray, const Vector3& throughput, uint32_t pixelIndex, float neeBsdfPdf)
+		{
+			rays.push_back(ray);
+			throughputs.push_back(throughput);
+			pixelIndices.push_back(pixelIndex);
+			neeBsdfPdfs.push_back(neeBsdfPdf);
+		}
+
+		uint32_t size() const { return static_cast<uint32_t>(rays.size()); }
+		bool empty() const { return rays.empty(); }
+
+		void clear()
+		{
+			rays.clear();
+			hitInfos.clear();
+			throughputs.clear();
+			pixelIndices.clear();
+			neeBsdfPdfs.clear();
+		}
+	};
+
+	// Occlusion tests of the light samples, the contribution is added when the ray reaches the light
+	struct ShadowQueue
+	{
+		std::vector<Ray> rays;
+		std::vector<Vector3> contributions;
+		std::vector<uint32_t> pixelIndices;
+		std::vector<OccluderCache::Occluder*> occluders; // cached blocker of the light the ray goes to
+
+		void push(const Ray& ray, const Vector3& contribution, uint32_t pixelIndex, OccluderCache::Occluder& occluder)
+		{
+			rays.push_back(ray);
+			contributions.push_back(contribution);
+			pixelIndices.push_back(pixelIndex);
+			occluders.push_back(&occluder);
+		}
+
+		void clear()
+		{
+			rays.clear();
+			contributions.clear();
+			pixelIndices.clear();
+			occluders.clear();
+		}
+	};
+
+	enum ShadeStage
+	{
+		MISS,
+		DIFFUSE,
+		EMISSIVE,
+		REFLECTIVE,
+		REFRACTIVE,
+		SHADE_STAGE_COUNT
+	};
+
+	// Camera paths of the pixels of the bucket that did not converge yet
+	void generate(const Film& film, uint32_t startRow, uint32_t endRow, uint32_t startColumn, uint32_t endColumn)
+	{
+		const uint32_t imageWidth = scene.settings.imageSettings.width;
+		const uint32_t imageHeight = scene.settings.imageSettings.height;
+
+		uint32_t pixelIndex = 0;
+		for (uint32_t rowIdx = startRow; rowIdx < endRow; ++rowIdx)
+		{
+			for (uint32_t colIdx = startColumn; colIdx < endColumn; ++colIdx, ++pixelIndex)
+			{
+				if (film.isConverged(colIdx, rowIdx))
+					continue;
+
+				const float y = static_cast<float>(rowIdx) + randomSampler.next1D();
+				const float x = static_cast<float>(colIdx) + randomSampler.next1D();
+				const Vector2 samplePosition = Camera::toScreenSpace(x, y, imageWidth, imageHeight);
+				paths.push(scene.camera.generateRay(samplePosition.x, samplePosition.y), Vector3{1.f}, pixelIndex, 0.f);
+			}
+		}
+	}
+
+	void extend()
+	{
+		paths.hitInfos.resize(paths.size());
+		for (uint32_t pathIndex = 0; pathIndex < paths.size(); ++pathIndex)
+			paths.hitInfos[pathIndex] = scene.closestHit(paths.rays[pathIndex]);
+	}
+
+	// Sorts the paths by material type and shades each group. New paths are queued only when extendPaths is set,
+	// i.e. below the trace depth
+	void shade(bool extendPaths)
+	{
+		for (auto& stagePathIndices : shadeStagePaths)
+			stagePathIndices.clear();
+
+		for (uint32_t pathIndex = 0; pathIndex < paths.size(); ++pathIndex)
+			shadeStagePaths[getShadeStage(paths.hitInfos[pathIndex])].push_back(pathIndex);
+
+		shadeMisses();
+		shadeEmissive();
+		shadeDiffuse(extendPaths);
+		if (extendPaths)
+		{
+			shadeReflective();
+			shadeRefractive();
+		}
+	}
+
+	void traceShadowRays()
+	{
+		for (uint32_t shadowIndex = 0; shadowIndex < shadowRays.rays.size(); ++shadowIndex)
+		{
+			Ray& shadowRay = shadowRays.rays[shadowIndex];
+			if (!scene.anyHit(shadowRay, *shadowRays.occluders[shadowIndex], occluderCache.stats))
+				radiance[shadowRays.pixelIndices[shadowIndex]] += shadowRays.contributions[shadowIndex];
+		}
+		shadowRays.clear();
+	}
+
+	ShadeStage getShadeStage(const HitInfo& hitInfo) const
+	{
+		if (!hitInfo.hit)
+			return MISS;
+
+		switch (scene.materials[hitInfo.materialIndex].type)
+		{
+		case Material::Type::EMISSIVE:
+			return EMISSIVE;
+		case Material::Type::REFLECTIVE:
+			return REFLECTIVE;
+		case Material::Type::REFRACTIVE:
+			return REFRACTIVE;
+		case Material::Type::CONSTANT:
+		case Material::Type::DIFFUSE:
+		default:
+			return DIFFUSE;
+		}
+	}
+
+	void shadeMisses()
+	{
+		for (uint32_t pathIndex : shadeStagePaths[MISS])
+			radiance[paths.pixelIndices[pathIndex]] += paths.throughputs[pathIndex] * scene.settings.backgroundColor;
+	}
+
+	void shadeEmissive()
+	{
+		for (uint32_t pathIndex : shadeStagePaths[EMISSIVE])
+		{
+			const HitInfo& hitInfo = paths.hitInfos[pathIndex];
+			const float neeBsdfPdf = paths.neeBsdfPdfs[pathIndex];
+
+			float misWeight = 1.f;
+			if (neeBsdfPdf > 0.f)
+			{
+				const int32_t emissiveIndex = scene.getEmissiveIndex(hitInfo);
+				assert(emissiveIndex != -1);
+				float lightPdf = scene.emissiveSampler.evalPdf(emissiveIndex, paths.rays[pathIndex].origin,
+				                                               hitInfo.point);
+				misWeight = Sampling::powerHeuristic(neeBsdfPdf, lightPdf);
+			}
+			radiance[paths.pixelIndices[pathIndex]] += paths.throughputs[pathIndex] *
+				scene.materials[hitInfo.materialIndex].emission * misWeight;
+		}
+	}
+
+	// Point lights and the emissive light sample go to the shadow queue, the cosine-weighted bounce to the next paths
+	void shadeDiffuse(bool extendPaths)
+	{
+		for (uint32_t pathIndex : shadeStagePaths[DIFFUSE])
+		{
+			const HitInfo& hitInfo = paths.hitInfos[pathIndex];
+			const Vector3& throughput = paths.throughputs[pathIndex];
+			const uint32_t pixelIndex = paths.pixelIndices[pathIndex];
+
+			const auto& material = scene.materials[hitInfo.materialIndex];
+			const Vector3 normal = material.smoothShading ? scene.getShadingNormal(hitInfo) : hitInfo.normal;
+			const Vector3 offsetOrigin = OffsetRayOrigin(hitInfo.point, hitInfo.normal);
+
+			Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, scene.getUVs(hitInfo));
+			Vector3 bsdf = albedo / PI;
+
+			for (size_t lightIndex = 0; lightIndex < scene.lights.size(); ++lightIndex)
+			{
+				const auto& light = scene.lights[lightIndex];
+				Vector3 dirToLight = Normalize(light.position - offsetOrigin);
+				float distanceToLight = (light.position - offsetOrigin).magnitude();
+				float nDotL = std::max(0.f, Dot(normal, dirToLight));
+				if (nDotL > 0.f)
+				{
+					float attenuation = 1.0f / (distanceToLight * distanceToLight);
+					shadowRays.push(Ray{offsetOrigin, dirToLight, distanceToLight},
+					                throughput * albedo * nDotL * attenuation * light.intensity, pixelIndex,
+					                occluderCache.getPointLightOccluder(lightIndex));
+				}
+			}
+
+			std::optional<EmissiveLightSample> lightSampleOpt = scene.emissiveSampler.sample(
+				offsetOrigin, randomSampler.next3D());
+			if (lightSampleOpt.has_value())
+			{
+				EmissiveLightSample lightSample = lightSampleOpt.value();
+				Vector3 dirToLight = Normalize(lightSample.position - offsetOrigin);
+				float distanceToLight = (lightSample.position - offsetOrigin).magnitude();
+				float nDotL = std::max(0.f, Dot(normal, dirToLight));
+
+				float lightPdf = lightSample.pdf;
+				float bsdfPdf = std::max(0.f, Dot(hitInfo.normal, dirToLight)) / PI;
+				float misWeight = Sampling::powerHeuristic(lightPdf, bsdfPdf);
+
+				if (lightPdf > 0.f && nDotL > 0.f)
+					shadowRays.push(Ray{offsetOrigin, dirToLight, distanceToLight * (1.f - SHADOW_RAY_EPSILON)},
+					                throughput * misWeight * bsdf * nDotL * lightSample.Le / lightPdf, pixelIndex,
+					                occluderCache.getEmissiveOccluder());
+			}
+
+			if (!extendPaths)
+				continue;
+
+			Vector3 randomDirection = randomInHemisphereCosine(hitInfo.normal, randomSampler.next2D());
+			float pdf = std::max(0.f, Dot(hitInfo.normal, randomDirection)) / PI;
+			float nDotL = std::max(0.f, Dot(normal, randomDirection));
+			if (pdf > 0.f)
+				nextPaths.push(Ray{offsetOrigin, randomDirection}, throughput * bsdf * nDotL / pdf, pixelIndex, pdf);
+		}
+	}
+
+	void shadeReflective()
+	{
+		for (uint32_t pathIndex : shadeStagePaths[REFLECTIVE])
+		{
+			const Ray& ray = paths.rays[pathIndex];
+			const HitInfo& hitInfo = paths.hitInfos[pathIndex];
+
+			const auto& material = scene.materials[hitInfo.materialIndex];
+			const Vector3 normal = material.smoothShading ? scene.getShadingNormal(hitInfo) : hitInfo.normal;
+
+			Vector3 reflectionDir = Normalize(ray.directionN - normal * 2.f * Dot(normal, ray.directionN));
+			Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, scene.getUVs(hitInfo));
+			nextPaths.push(Ray{OffsetRayOrigin(hitInfo.point, hitInfo.normal), reflectionDir},
+			               paths.throughputs[pathIndex] * albedo, paths.pixelIndices[pathIndex], 0.f);
+		}
+	}
+
+	// Below the critical angle the path splits into a refracted and a reflected path weighted by the fresnel term
+	void shadeRefractive()
+	{
+		for (uint32_t pathIndex : shadeStagePaths[REFRACTIVE])
+		{
+			const Ray& ray = paths.rays[pathIndex];
+			const HitInfo& hitInfo = paths.hitInfos[pathIndex];
+			const uint32_t pixelIndex = paths.pixelIndices[pathIndex];
+
+			const auto& material = scene.materials[hitInfo.materialIndex];
+			Vector3 normal = material.smoothShading ? scene.getShadingNormal(hitInfo) : hitInfo.normal;
+
+			Vector3 albedo = material.getAlbedo(hitInfo.barycentrics, scene.getUVs(hitInfo));
+			Vector3 throughput = paths.throughputs[pathIndex] * albedo;
+
+			float eta = material.ior;
+			Vector3 wi = -ray.directionN;
+			float cosThetaI = Dot(normal, wi);
+			bool flipOrientation = cosThetaI < 0.f;
+			if (flipOrientation)
+			{
+				eta = 1.f / eta;
+				cosThetaI = -cosThetaI;
+				normal = -normal;
+			}
+
+			float sin2ThetaI = std::max(0.f, 1.f - cosThetaI * cosThetaI);
+			float sin2ThetaT = sin2ThetaI / (eta * eta);
+			Vector3 reflectionDir = Normalize(ray.directionN - normal * 2.f * Dot(normal, ray.directionN));
+			if (sin2ThetaT >= 1.f)
+			{
+				// Total internal reflection case
+				nextPaths.push(Ray{OffsetRayOrigin(hitInfo.point, hitInfo.normal), reflectionDir}, throughput,
+				               pixelIndex, 0.f);
+				continue;
+			}
+
+			float cosThetaT = std::sqrt(1.f - sin2ThetaT);
+			Vector3 wt = -wi / eta + (cosThetaI / eta - cosThetaT) * normal;
+			float fresnel = 0.5f * std::powf(1.f + Dot(ray.directionN, normal), 5);
+
+			Vector3 offsetOriginRefraction = OffsetRayOrigin(hitInfo.point,
+			                                                 flipOrientation ? hitInfo.normal : -hitInfo.normal);
+			nextPaths.push(Ray{offsetOriginRefraction, wt}, throughput * (1.f - fresnel), pixelIndex, 0.f);
+
+			Vector3 offsetOriginReflection = OffsetRayOrigin(hitInfo.point,
+			                                                 flipOrientation ? -hitInfo.normal : hitInfo.normal);
+			nextPaths.push(Ray{offsetOriginReflection, reflectionDir}, throughput * fresnel, pixelIndex, 0.f);
+		}
+	}
+
+	const Scene& scene;
+	OccluderCache& occluderCache;
+	Sampling::RandomSampler randomSampler;
+
+	std::vector<Vector3> radiance; // of the current sample of every pixel of the bucket, row by row
+	PathQueue paths;
+	PathQueue nextPaths;
+	ShadowQueue shadowRays;
+	std::array<std::vector<uint32_t>, SHADE_STAGE_COUNT> shadeStagePaths; // indices into paths
+};
@@ -0,0 +1,107 @@
+#pragma once
+#include <cstdint>
+#include <limits>
+
+#include "AABB.hpp"
+#include "SIMD.hpp"
+
+// Ray broadcast into SIMD lanes once per traversal
+template <uint32_t Width>
+struct WideRay
+{
+	using FloatW = typename SIMD::FloatN<Width>::Type;
+
+	explicit WideRay(const Ray& ray)
+	{
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			origin[axis] = FloatW::broadcast(ray.origin[axis]);
+			directionInv[axis] = FloatW::broadcast(ray.directionNInv[axis]);
+			dirIsNegative[axis] = ray.directionNInv[axis] < 0.f;
+		}
+	}
+
+	FloatW origin[3];
+	FloatW directionInv[3];
+	bool dirIsNegative[3];
+};
+
+// Node of a BVH with up to Width children, collapsed from the binary BVH.
+// Child bounds are stored as structure of arrays so that a single SIMD slab test covers all children
+template <uint32_t Width>
+struct alignas(32) WideBVHNode
+{
+	using FloatW = typename SIMD::FloatN<Width>::Type;
+
+	float bounds[2][3][Width]; // [min/max][axis][child]
+
+	uint32_t children[Width]; // wide node index (interior child) or primitives offset (leaf child)
+	uint16_t primitiveCounts[Width]; // 0 -> interior child
+	uint8_t childCount = 0;
+
+	WideBVHNode()
+	{
+		// Unused slots keep an empty box
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			for (uint32_t slot = 0; slot < Width; ++slot)
+			{
+				bounds[0][axis][slot] = std::numeric_limits<float>::max();
+				bounds[1][axis][slot] = -std::numeric_limits<float>::max();
+			}
+		}
+	}
+
+	void setChild(uint32_t slot, const AABB& boundingBox, uint32_t child, uint16_t primitiveCount)
+	{
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			bounds[0][axis][slot] = boundingBox.minPoint[axis];
+			bounds[1][axis][slot] = boundingBox.maxPoint[axis];
+		}
+		children[slot] = child;
+		primitiveCounts[slot] = primitiveCount;
+	}
+
+	AABB getChildBounds(uint32_t slot) const
+	{
+		AABB boundingBox;
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			boundingBox.minPoint[axis] = bounds[0][axis][slot];
+			boundingBox.maxPoint[axis] = bounds[1][axis][slot];
+		}
+		return boundingBox;
+	}
+
+	AABB getBounds() const
+	{
+		AABB boundingBox;
+		for (uint32_t slot = 0; slot < childCount; ++slot)
+			boundingBox |= getChildBounds(slot);
+		return boundingBox;
+	}
+
+	// Returns the bit mask of children hit within [0, maxT] and writes their entry distances to tEntry.
+	// The near and far planes are picked by the ray direction sign, so no per-lane swap is needed
+	uint32_t intersect(const WideRay<Width>& ray, float maxT, float* tEntry) const
+	{
+		FloatW tNear = FloatW::broadcast(0.f);
+		FloatW tFar = FloatW::broadcast(maxT);
+		const FloatW farScale = FloatW::broadcast(1.f + std::numeric_limits<float>::epsilon());
+
+		for (uint8_t axis = 0; axis < 3; ++axis)
+		{
+			const bool negative = ray.dirIsNegative[axis];
+			FloatW t1 = (FloatW::load(bounds[negative][axis]) - ray.origin[axis]) * ray.directionInv[axis];
+			FloatW t2 = (FloatW::load(bounds[!negative][axis]) - ray.origin[axis]) * ray.directionInv[axis];
+
+			// Accumulator goes second, so NaNs from 0 * inf keep the previous value
+			tNear = SIMD::max(t1, tNear);
+			tFar = SIMD::min(t2 * farScale, tFar);
+		}
+
+		tNear.store(tEntry);
+		return SIMD::lessMask(tNear, tFar) & ((1u << childCount) - 1u);
+	}
+};